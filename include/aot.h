@@ -0,0 +1,72 @@
+#ifndef _AOT_H
+#define _AOT_H
+
+#include <stdbool.h>
+
+#include "chip8.h"
+
+// Version of the interface between the runners and the roms compiled by chip8-aot
+#define CHIP8_AOT_ABI 5
+
+// Symbol under which each compiled rom exports its Chip8AotModule
+#define CHIP8_AOT_SYMBOL "chip8_aotModule"
+
+// State the compiled code runs with
+typedef struct
+{
+    long fuel; // Instructions the compiled code may still run
+
+    // Blocks, by their start address, whose code was written to since the rom was compiled
+    bool stale[4096];
+
+    // Core functions the compiled code calls into
+    bool (*drawSprite)(Chip8 *chip8, unsigned char x, unsigned char y, unsigned char height, unsigned short I);
+    void (*invalidateCode)(Chip8 *chip8, unsigned short address, unsigned short length);
+    unsigned char (*random)(Chip8 *chip8);
+} Chip8AotContext;
+
+// Interface of a rom compiled by chip8-aot
+typedef struct
+{
+    unsigned int abi;        // CHIP8_AOT_ABI of the compiler
+    unsigned int chip8Size;  // sizeof(Chip8) of the compiler, as the code accesses its fields
+    const unsigned char *image; // Rom the code was compiled from, which must be the one loaded at 0x200
+    unsigned short imageSize;
+
+    /*
+     * Run the compiled blocks from PC while there's fuel for whole blocks. Return at the
+     * first address without a block, an instruction left to the interpreter, a draw, a
+     * write to the sound timer or a write over compiled code.
+     */
+    void (*run)(Chip8 *chip8, Chip8AotContext *context);
+
+    // Mark the blocks holding any of the given bytes as stale. Return whether there was any
+    bool (*invalidate)(Chip8AotContext *context, unsigned short address, unsigned short length);
+} Chip8AotModule;
+
+// Compiled rom bound to a single Chip8
+typedef struct Chip8Aot Chip8Aot;
+
+/*
+ * Load the rom compiled into the shared object at the given path for the given Chip8,
+ * whose program must already be loaded. Return NULL when it can't be loaded or was
+ * compiled from another rom or core; chip8_runFor() is the fallback.
+ */
+Chip8Aot *aot_load(Chip8 *chip8, const char *path);
+
+/*
+ * Same as chip8_runFor(), producing the same machine state, but running the compiled
+ * code. Instructions it doesn't have, like the ones reached through Bnnn or rewritten
+ * by the program, are run by the interpreter, as is everything under CHIP8_COST_VIP.
+ */
+Chip8StopReason aot_runFor(Chip8Aot *aot, double deltaTime, unsigned int maxCycles);
+
+/*
+ * Check every compiled block against the code now in the Chip8 memory. Must be called
+ * after writing to it from outside the core, like when restoring a state.
+ */
+void aot_refresh(Chip8Aot *aot);
+
+void aot_destroy(Chip8Aot *aot);
+
+#endif
@@ -2,10 +2,14 @@
 #define _AUDIO_H
 
 #include <stdbool.h>
+#include <stdatomic.h>
 
-bool audio_init(double sine_frequency);
-void audio_play();
-void audio_stop();
+/*
+ * Open the audio device, which plays a tone of the given frequency whenever the given
+ * flag is set. The flag is read by the audio callback, so whoever sets it never waits
+ * on the device.
+ */
+bool audio_init(double sine_frequency, const atomic_bool *sounding);
 void audio_destroy();
 
 #endif
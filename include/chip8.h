@@ -2,10 +2,87 @@
 #define _CHIP8_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
-#define CHIP8_GFX_W 64
+#define CHIP8_GFX_W 64 // Matches the bits of a display row, see Chip8.gfx
 #define CHIP8_GFX_H 32
 
+// Granularity of the memory writes tracked by Chip8.dirtyPages
+#define CHIP8_PAGE_SIZE 64
+
+// State of the pixel at (x, y) of the display rows
+#define CHIP8_GFX_PIXEL(gfx, x, y) (((gfx)[y] >> (CHIP8_GFX_W - 1 - (x))) & 1)
+
+// dt and st are decreased at 60Hz
+#define CHIP8_TIMERS_TIMESTEP (1.0 / 60.0)
+#define CHIP8_TIMERS_FREQUENCY 60
+
+// Virtual cycles of an instruction under CHIP8_COST_FLAT, which makes the clock run at 60 times the processor frequency
+#define CHIP8_FLAT_COST CHIP8_TIMERS_FREQUENCY
+
+// Machine cycles per second of the COSMAC VIP (1.76MHz, 8 clocks per machine cycle), rounded to whole 60Hz frames
+#define CHIP8_VIP_CYCLE_FREQUENCY 220080
+
+// Instruction with its operands already extracted from the opCode
+typedef struct
+{
+    unsigned char op; // Index of the instruction handler. 0 while not decoded
+    unsigned char x;
+    unsigned char y;
+    unsigned char kk; // Lowest byte, whose lowest nibble is n
+    unsigned short nnn;
+} Chip8DecodedOp;
+
+#ifdef CHIP8_PROFILE
+#    include <stdio.h>
+
+// Upper bound of the instruction handlers of the core
+#    define CHIP8_PROFILE_HANDLERS 48
+
+/*
+ * Counters of a Chip8 built with -DCHIP8_PROFILE (make PROFILE=1). Per instruction, they
+ * only cover the interpreter and threaded cores; the JIT and AOT only add up what their
+ * native code ran. Times are in ticks of the TSC on x86, in nanoseconds elsewhere.
+ */
+typedef struct
+{
+    unsigned long long executed[CHIP8_PROFILE_HANDLERS]; // Per instruction handler
+    unsigned long long ticks[CHIP8_PROFILE_HANDLERS];
+    unsigned long long pcExecuted[4096]; // Per address of the instructions
+    unsigned long long pcTicks[4096];
+    unsigned char pcHandler[4096]; // Handler of the latest instruction run at each address
+
+    unsigned long long draws;
+    unsigned long long collisions;
+
+    // Instructions fast-forwarded by chip8_skipIdle(), by what the program was waiting for
+    unsigned long long timerWaitCycles; // dt, polled through Fx07
+    unsigned long long keyWaitCycles;   // A key, through Fx0A
+    unsigned long long spinCycles;      // Nothing, in a jump to itself
+
+    unsigned long long nativeInstructions; // Run by the JIT or AOT
+} Chip8Profile;
+
+// The statements given are only compiled in profiling builds
+#    define CHIP8_PROFILED(...) __VA_ARGS__
+#else
+#    define CHIP8_PROFILED(...)
+#endif
+
+// Ways of executing the instructions, all producing the same machine state
+typedef enum
+{
+    CHIP8_CORE_INTERPRETER, // One handler call per instruction
+    CHIP8_CORE_THREADED     // Direct-threaded loop over the whole timeslice (chip8_runFor only)
+} Chip8Core;
+
+// Virtual cycles consumed by each instruction
+typedef enum
+{
+    CHIP8_COST_FLAT, // CHIP8_FLAT_COST for every instruction
+    CHIP8_COST_VIP   // COSMAC VIP machine cycles, growing with the rows of Dxyn and the registers of Fx55/Fx65
+} Chip8CostModel;
+
 typedef struct
 {
     // 4,096 bytes of memory
@@ -25,26 +102,227 @@ typedef struct
 
     bool drawFlag;
 
-    // State of each pixel on the 64x32 display
-    bool gfx[CHIP8_GFX_W * CHIP8_GFX_H];
+    // Each row of the 64x32 display, one bit per pixel, the leftmost one being the most significant
+    uint64_t gfx[CHIP8_GFX_H];
 
     // State of each key on the HEX based keypad
     bool key[16];
 
     // Quirks
     bool shiftQuirk;
+
+    // State of the xorshift64* generator behind Cxkk, never 0. See chip8_seed()
+    uint64_t rng;
+
+    /*
+     * Virtual time. Every instruction consumes cycles of a virtual clock, as given by
+     * costModel, out of the budget the host grants, and dt and st tick every timerPeriod
+     * cycles of that clock. What the program observes only depends on the instructions
+     * it ran, never on how the host sliced the time, so runs are reproducible.
+     */
+    Chip8CostModel costModel;
+    unsigned long cycleFrequency; // Virtual cycles per second. 0 for an unrestricted processor frequency
+    unsigned long timerPeriod;    // Virtual cycles between two dt/st ticks
+    unsigned long timerCycles;    // Virtual cycles since the latest dt/st tick
+    unsigned long long clock;     // Virtual cycles since chip8_init()
+    long budget;                  // Virtual cycles granted and not consumed yet. Negative when the latest instruction overran it
+    double budgetFraction;        // Part of a virtual cycle granted and not added to the budget yet
+
+    // Time passed since the latest dt/st tick, with an unrestricted processor frequency only
+    double tTimerRegistersFrequency;
+
+    // Define whether the PC should advance to the next operation after execution
+    bool increasePC;
+
+    // Core used by chip8_runFor()
+    Chip8Core core;
+
+    // Where chip8_runFor() records every instruction it runs, NULL when not tracing. See trace.h
+    struct Chip8Trace *trace;
+
+    // Instructions executed since chip8_init()
+    unsigned long cycles;
+
+    /*
+     * Writes to the memory and the display, one bit per CHIP8_PAGE_SIZE bytes of memory and
+     * per display row, set by the core and chip8_invalidateCode() and only ever cleared by
+     * whoever keeps track of them, like the rewind buffer.
+     */
+    uint64_t dirtyPages;
+    uint32_t dirtyRows;
+
+    // Instructions decoded at each address, kept until that memory is written to
+    Chip8DecodedOp decoded[4096];
+
+#ifdef CHIP8_PROFILE
+    // Counted since chip8_init()
+    Chip8Profile profile;
+#endif
 } Chip8;
 
+// "C8SS" read as a little endian uint32_t
+#define CHIP8_STATE_MAGIC 0x53533843
+
+// Version of the Chip8State layout
+#define CHIP8_STATE_VERSION 2
+
+/*
+ * Snapshot of everything a Chip8 runs with, besides the decoded instructions and the
+ * core, which don't change what the program observes. Only fixed-width fields in host
+ * byte order, largest first and without padding, so a state can be written to a file
+ * and mapped back from it as is, and restoring one is little more than a memcpy.
+ */
+typedef struct
+{
+    uint32_t magic;   // CHIP8_STATE_MAGIC
+    uint32_t version; // CHIP8_STATE_VERSION
+    uint32_t size;    // sizeof(Chip8State)
+    uint32_t reserved;
+    uint64_t checksum; // Of every byte after this field
+
+    uint64_t gfx[CHIP8_GFX_H];
+    uint64_t cycles;
+    uint64_t clock;
+    uint64_t cycleFrequency;
+    uint64_t timerPeriod;
+    uint64_t timerCycles;
+    uint64_t rng;
+    int64_t budget;
+    double budgetFraction;
+    double tTimerRegistersFrequency;
+
+    uint32_t costModel;
+    uint16_t I;
+    uint16_t PC;
+    uint16_t stack[16];
+
+    uint8_t memory[4096];
+    uint8_t V[18];
+    uint8_t SP;
+    uint8_t dt;
+    uint8_t st;
+    uint8_t key[16];
+    uint8_t shiftQuirk;
+    uint8_t drawFlag;
+    uint8_t padding; // Keeps the size a multiple of 8 bytes
+} Chip8State;
+
 // Open and read file with given [directory/]filename. Return whether it succeeded or not
 bool chip8_loadGame(Chip8 *chip8, char *file);
 
 /*
- * Initialize the chip8 module with given processor frequency.
+ * Initialize the given Chip8 with given processor frequency, on CHIP8_COST_FLAT.
  * If processor_freq is less than or equal to 0, the processor
- * frequency will be set to unrestricted.
+ * frequency will be set to unrestricted and dt and st follow the host's time.
+ * Every Chip8 carries all of its own state, so any amount of them can run
+ * side by side, as long as each one is used by a single thread at a time.
  */
 void chip8_init(Chip8 *chip8, int processor_freq);
 
+/*
+ * Seed the random number generator of Cxkk. A seed of 0 selects the one chip8_init()
+ * starts with, so the same program given the same input always draws the same numbers.
+ */
+void chip8_seed(Chip8 *chip8, uint64_t seed);
+
+// Next byte drawn from the random number generator
+unsigned char chip8_random(Chip8 *chip8);
+
+/*
+ * Switch to the given cost model. CHIP8_COST_VIP also runs the virtual clock at
+ * CHIP8_VIP_CYCLE_FREQUENCY, replacing the processor frequency; CHIP8_COST_FLAT keeps
+ * the clock as is. An unrestricted processor frequency stays unrestricted.
+ */
+void chip8_setCostModel(Chip8 *chip8, Chip8CostModel model);
+
+/*
+ * Drop the decoded instructions overlapping the given range of memory and mark its pages
+ * as dirty. Must be called after writing to chip8->memory from outside the core.
+ */
+void chip8_invalidateCode(Chip8 *chip8, unsigned short address, unsigned short length);
+
 bool chip8_emulateCycle(Chip8 *chip8, double deltaTime);
 
+// Reasons for chip8_runFor() to hand control back to the host
+typedef enum
+{
+    CHIP8_STOP_BUDGET,   // The whole timeslice was executed
+    CHIP8_STOP_DRAW,     // The display changed (00E0 or Dxyn)
+    CHIP8_STOP_SOUND,    // The sound timer started or stopped
+    CHIP8_STOP_KEY_WAIT, // Fx0A is waiting for a key press
+    CHIP8_STOP_ERROR     // Invalid opCode, stack fault or PC out of memory
+} Chip8StopReason;
+
+/*
+ * Grant deltaTime seconds worth of virtual cycles to the budget and execute
+ * instructions in a tight loop while it lasts, ticking dt and st on the virtual
+ * clock. At most maxCycles instructions are executed; with an unrestricted
+ * processor frequency that is the only limit and the timers are advanced by
+ * deltaTime upfront. Whatever part of the budget is left when returning early
+ * (draw, sound edge, key wait) is kept and consumed by the next call.
+ */
+Chip8StopReason chip8_runFor(Chip8 *chip8, double deltaTime, unsigned int maxCycles);
+
+/*
+ * Amount of instructions, up to limit, that can run before the budget runs out, with
+ * dt and st ticking after the last one at the earliest. Cores running whole blocks of
+ * instructions at once account for them with chip8_advanceClock() and leave the same
+ * timing state as chip8_runFor(). Restricted frequencies on CHIP8_COST_FLAT only.
+ */
+unsigned long chip8_timingWindow(const Chip8 *chip8, unsigned long limit);
+
+// Consume the given virtual cycles from the budget, ticking dt and st every timerPeriod cycles
+void chip8_advanceClock(Chip8 *chip8, unsigned long cycles);
+
+// Run native code from chip8->PC for at most fuel instructions, returning how many ran, 0 when there's none
+typedef unsigned long (*Chip8NativeRun)(void *backend, Chip8 *chip8, unsigned long fuel);
+
+// Drop native code over the given bytes, which the interpreter just wrote with Fx33 or Fx55
+typedef void (*Chip8NativeInvalidate)(void *backend, unsigned short address, unsigned short length);
+
+/*
+ * Same as chip8_runFor(), producing the same machine state, for cores running whole blocks
+ * of native code: blocks are run through the given callback for as long as the timing
+ * window allows, and whatever it has no code for through the interpreter, which reports
+ * the bytes it writes. Native code leaves right after any instruction setting drawFlag.
+ * Everything but CHIP8_COST_FLAT, and tracing, goes to the interpreter.
+ */
+Chip8StopReason chip8_runNative(Chip8 *chip8, double deltaTime, unsigned int maxCycles, Chip8NativeRun run, Chip8NativeInvalidate invalidate, void *backend);
+
+/*
+ * Fast-forward through the idle loop starting at PC, if any: Fx0A waiting for a key,
+ * a jump to itself, or Fx07 Vx / 3xkk or 4xkk on Vx / 1nnn back to the Fx07 while dt
+ * keeps the skip from happening. Whole iterations are accounted for at once, up to the
+ * one reading the dt that ends the loop, the tick stopping the sound timer, the end of
+ * the budget or limit instructions, leaving the same state as running them.
+ * Return the amount of instructions skipped, to be added to chip8->cycles by the caller.
+ */
+unsigned long chip8_skipIdle(Chip8 *chip8, unsigned long limit);
+
+// Capture the whole machine into the given state
+void chip8_saveState(const Chip8 *chip8, Chip8State *state);
+
+/*
+ * Restore the machine captured in the given state, keeping the core in use. Return false,
+ * leaving the Chip8 untouched, when it has another layout or version, fails its checksum
+ * or holds a stack pointer, cost model or timer period the cores can't run with.
+ * Only the decoded instructions whose memory differs are dropped; translations made by
+ * the JIT or AOT need jit_flush() or aot_refresh() afterwards.
+ */
+bool chip8_loadState(Chip8 *chip8, const Chip8State *state);
+
+#ifdef CHIP8_PROFILE
+// Write the given profile as a JSON object, under the given name
+void chip8_profileJson(const Chip8Profile *profile, const char *name, FILE *fp);
+
+/*
+ * Write the time spent on each address of the given profile as folded stacks, for
+ * flamegraph.pl and the like: "<name>;nib<X>;<handler>;<address> <ticks>" per line.
+ */
+void chip8_profileFolded(const Chip8Profile *profile, const char *name, FILE *fp);
+#endif
+
+// XOR the n-byte sprite at memory location I onto (x, y). Return whether any pixel was erased
+bool chip8_drawSprite(Chip8 *chip8, unsigned char x, unsigned char y, unsigned char height, unsigned short I);
+
 #endif
@@ -0,0 +1,106 @@
+#ifndef _ENV_H
+#define _ENV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// "C8EV" read as a little endian uint32_t
+#define CHIP8_ENV_MAGIC 0x56453843
+
+// Version of the layout of the observation region
+#define CHIP8_ENV_VERSION 1
+
+// Values of guest memory an observation can carry, see env_addHook()
+#define CHIP8_ENV_HOOKS 8
+
+/*
+ * What a machine looks like after a step, written in place into the observation region
+ * and never moved, so a consumer mapping the same region reads it without any copy. Only
+ * fixed-width fields in host byte order, like Chip8State.
+ */
+typedef struct
+{
+    uint64_t gfx[CHIP8_GFX_H];        // Display rows, as Chip8.gfx
+    uint64_t cycles;                  // Instructions run, as Chip8.cycles
+    uint32_t hooks[CHIP8_ENV_HOOKS];  // Value of each hook after the step
+    int32_t rewards[CHIP8_ENV_HOOKS]; // Change of each hook during the step
+    uint32_t step;                    // Steps since the machine was reset
+    uint8_t sound;                    // Whether the sound timer is running
+    uint8_t done;                     // The machine halted, and stays so until reset
+    uint8_t padding[2];
+} Chip8EnvObservation;
+
+// Start of the observation region, followed by one Chip8EnvObservation per machine
+typedef struct
+{
+    uint32_t magic;                   // CHIP8_ENV_MAGIC
+    uint32_t version;                 // CHIP8_ENV_VERSION
+    uint32_t count;   // Machines, and observations following the header
+    uint32_t hooks;   // Hooks set by env_addHook()
+    uint64_t steps;   // Calls to env_step(), bumped once all of its observations are written
+} Chip8EnvHeader;
+
+/*
+ * Batch of machines stepped together: each step sets the keypad of every machine from
+ * an action, runs it for the given amount of 60Hz frames of virtual time and writes its
+ * observation. Only the display rows drawn during the step are written, as tracked by
+ * Chip8.dirtyRows, which the batch takes over.
+ */
+typedef struct Chip8Env Chip8Env;
+
+// Bytes of the observation region of the given amount of machines
+size_t env_regionSize(unsigned int count);
+
+/*
+ * Create the given amount of machines, each a copy of the Chip8, whose rom is already
+ * loaded, taking its state as the snapshot env_reset() goes back to. They run on its core
+ * and timing, which has to be a restricted processor frequency. Observations are written
+ * to the given region of env_regionSize() bytes, 8-byte aligned, or to one of the batch's
+ * own when NULL. Return NULL, printing why to stderr, on failure.
+ */
+Chip8Env *env_create(const Chip8 *chip8, unsigned int count, unsigned int frames, void *region);
+
+/*
+ * Same as env_create(), the observations going to the POSIX shared memory object of the
+ * given name (like "/chip8-env"), created or truncated, for other processes to map.
+ * It is unlinked by env_destroy().
+ */
+Chip8Env *env_createShared(const Chip8 *chip8, unsigned int count, unsigned int frames, const char *name);
+
+/*
+ * Observe the big endian value of the given amount of bytes (1 to 4) at the given address
+ * of every machine, like a score. Return false when all CHIP8_ENV_HOOKS are taken or the
+ * range is invalid.
+ */
+bool env_addHook(Chip8Env *env, unsigned short address, unsigned char size);
+
+// Seed the random number generator of a machine, like chip8_seed(), again on every reset to the initial snapshot
+void env_seed(Chip8Env *env, unsigned int machine, uint64_t seed);
+
+/*
+ * Set the keypad of every machine from its action, one bit per key, key 0 being the
+ * lowest, and run them all for a step. Machines that are done aren't run.
+ */
+void env_step(Chip8Env *env, const uint16_t *actions);
+
+/*
+ * Restore a machine to the given state, or to the one the batch was created from when
+ * NULL, writing its observation anew. Return false, leaving it untouched, when the state
+ * doesn't load (see chip8_loadState()) or has an unrestricted processor frequency.
+ */
+bool env_reset(Chip8Env *env, unsigned int machine, const Chip8State *state);
+
+const Chip8EnvHeader *env_header(const Chip8Env *env);
+
+// Observation of a machine, at the same place in the region after every step
+const Chip8EnvObservation *env_observation(const Chip8Env *env, unsigned int machine);
+
+// Machine itself, to be only read between steps
+const Chip8 *env_machine(const Chip8Env *env, unsigned int machine);
+
+void env_destroy(Chip8Env *env);
+
+#endif
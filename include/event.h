@@ -3,9 +3,20 @@
 
 #include <stdbool.h>
 
+#include "keyqueue.h"
+
 bool event_init();
-// Update the given keypad with the state of each key; Set the second arg to true in case of a quit event
-void event_update(bool keypad[16], bool *quit);
+
+/*
+ * Map the keypad, from key 0 to key F, to the keys of the given comma separated names, as
+ * SDL names them ("X", "1", "Keypad 0"...), for the keys at those places on a US layout.
+ * Must be called before event_init(). Return false, printing why to stderr, when any of
+ * them isn't known, there aren't exactly 16 of them or one key is given twice.
+ */
+bool event_setKeyMap(const char *names);
+
+// Push every change of the keypad to the queue, set whether the rewind key (Backspace) is held and set quit on a quit event
+void event_update(KeyQueue *queue, bool *rewind, bool *quit);
 void event_destroy();
 
 #endif
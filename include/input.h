@@ -0,0 +1,69 @@
+#ifndef _INPUT_H
+#define _INPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// "C8IN" read as a little endian uint32_t
+#define CHIP8_INPUT_MAGIC 0x4E493843
+
+// Version of the input log file format
+#define CHIP8_INPUT_VERSION 1
+
+// Keypad as of a given instruction
+typedef struct
+{
+    unsigned long cycle; // chip8->cycles of the first instruction that ran with this keypad
+    uint16_t keys;       // One bit per key, key 0 being the lowest
+} Chip8KeypadEvent;
+
+/*
+ * Everything needed to replay a session: how the Chip8 was set up, every change of the
+ * keypad along the virtual clock and the display it ended with. The program observes
+ * nothing else, so a replay reproduces the session exactly on any core and at any speed,
+ * as long as it ran at a restricted processor frequency.
+ *
+ * On file, a header in host byte order, with fixed-width fields like Chip8State, then
+ * each event as the cycles since the previous one in LEB128 and the keys in 2 bytes,
+ * lowest first.
+ */
+typedef struct
+{
+    int processorFreq;
+    Chip8CostModel costModel;
+    bool shiftQuirk;
+    uint64_t seed;
+    unsigned long cycles;      // Length of the session, in instructions
+    uint64_t gfx[CHIP8_GFX_H]; // Display at the end of the session
+
+    Chip8KeypadEvent *events;
+    unsigned int count;
+    unsigned int capacity;
+} Chip8InputLog;
+
+// Start a log of the session of the given Chip8, right after setting it up and before running it
+void input_start(Chip8InputLog *log, const Chip8 *chip8, int processorFreq);
+
+/*
+ * Log the keypad of the Chip8 if it changed, right after it was set and before running
+ * on. Events from chip8->cycles on are replaced, as by input_rewind(). Return false when
+ * out of memory.
+ */
+bool input_record(Chip8InputLog *log, const Chip8 *chip8);
+
+// Drop the events from chip8->cycles on, which didn't happen after all once the Chip8 was rewound
+void input_rewind(Chip8InputLog *log, const Chip8 *chip8);
+
+// Close the log of the session at the current state of the Chip8
+void input_finish(Chip8InputLog *log, const Chip8 *chip8);
+
+bool input_save(const Chip8InputLog *log, const char *path);
+
+// Read a log written by input_save(). Return false, printing why to stderr, when it can't be read
+bool input_load(Chip8InputLog *log, const char *path);
+
+void input_free(Chip8InputLog *log);
+
+#endif
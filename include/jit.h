@@ -0,0 +1,31 @@
+#ifndef _JIT_H
+#define _JIT_H
+
+#include <stdbool.h>
+
+#include "chip8.h"
+
+// Native code translated from the program of a single Chip8
+typedef struct Chip8Jit Chip8Jit;
+
+/*
+ * Create a JIT for the given Chip8, whose program must already be loaded.
+ * Return NULL when the host isn't supported (only x86-64 is) or the
+ * executable memory couldn't be allocated; chip8_runFor() is the fallback.
+ */
+Chip8Jit *jit_create(Chip8 *chip8);
+
+/*
+ * Same as chip8_runFor(), producing the same machine state, but running
+ * straight-line code natively. Instructions that draw, touch the stack,
+ * write memory or wait for input are run by the interpreter, as is
+ * everything under CHIP8_COST_VIP.
+ */
+Chip8StopReason jit_runFor(Chip8Jit *jit, double deltaTime, unsigned int maxCycles);
+
+// Drop every translation. Must be called after writing to the Chip8 memory from outside the core
+void jit_flush(Chip8Jit *jit);
+
+void jit_destroy(Chip8Jit *jit);
+
+#endif
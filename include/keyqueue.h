@@ -0,0 +1,50 @@
+#ifndef _KEYQUEUE_H
+#define _KEYQUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Transitions the queue holds at most, a power of 2
+#define KEYQUEUE_SIZE 256
+
+// Keypad right after a key was pressed or released
+typedef struct
+{
+    int64_t time;  // pacer_now() when the host saw it
+    uint16_t keys; // One bit per key, key 0 being the lowest
+} KeyTransition;
+
+/*
+ * Lock-free queue of keypad transitions from one producer thread, reading the host events,
+ * to one consumer thread, running the emulation. Each transition carries the whole keypad,
+ * so the consumer can apply them at the point of the virtual clock matching their time.
+ * The consumer also measures how long each one waited before being applied.
+ */
+typedef struct
+{
+    KeyTransition transitions[KEYQUEUE_SIZE];
+    atomic_ulong head; // Transitions ever pushed, written by the producer
+    atomic_ulong tail; // Transitions ever popped, written by the consumer
+
+    // Latency from the host seeing a transition to the emulation applying it. Consumer only
+    unsigned long applied;
+    int64_t latencyMax;
+    double latencySum;
+} KeyQueue;
+
+void keyqueue_init(KeyQueue *queue);
+
+// Push a transition. Return false, leaving it out, when the queue is full
+bool keyqueue_push(KeyQueue *queue, int64_t time, uint16_t keys);
+
+// Oldest transition not popped yet, NULL when there's none
+const KeyTransition *keyqueue_peek(KeyQueue *queue);
+
+// Drop the oldest transition once applied at the given time, counting its latency
+void keyqueue_pop(KeyQueue *queue, int64_t now);
+
+// Print the latency statistics to stdout
+void keyqueue_report(const KeyQueue *queue);
+
+#endif
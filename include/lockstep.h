@@ -0,0 +1,54 @@
+#ifndef _LOCKSTEP_H
+#define _LOCKSTEP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Lanes stepped together by a single vector instruction, one byte register each in an AVX2 register
+#define CHIP8_LOCKSTEP_WIDTH 32
+
+/*
+ * Many machines running the same rom, one per lane, stored as structure of arrays: each
+ * register, timer and display row of every lane next to each other. Every step runs one
+ * instruction on each lane. Where the lanes of a group of CHIP8_LOCKSTEP_WIDTH share their
+ * PC and opCode, AVX2 runs it on all of them at once; diverged groups, and instructions
+ * touching the memory, the stack or the display, run lane by lane.
+ *
+ * All lanes run the same amount of instructions, so they share a virtual clock, which
+ * only holds under CHIP8_COST_FLAT at a restricted processor frequency. Each lane ends up
+ * exactly as a Chip8 running the same instructions would. Build with -DCHIP8_NO_AVX2 to
+ * force the scalar path.
+ */
+typedef struct Chip8Lockstep Chip8Lockstep;
+
+/*
+ * Create the given amount of lanes, each a copy of the Chip8, whose rom is already loaded.
+ * Return NULL, printing why to stderr, when its timing isn't supported or out of memory.
+ */
+Chip8Lockstep *lockstep_create(const Chip8 *chip8, unsigned int lanes);
+
+// Seed the random number generator of a lane, like chip8_seed()
+void lockstep_seed(Chip8Lockstep *lockstep, unsigned int lane, uint64_t seed);
+
+// Set the keypad of a lane, one bit per key, key 0 being the lowest
+void lockstep_setKeys(Chip8Lockstep *lockstep, unsigned int lane, uint16_t keys);
+
+/*
+ * Run the given amount of instructions on every lane, those that halt on an invalid
+ * opCode, a stack fault or a PC out of memory stopping there. Return the lanes still running.
+ */
+unsigned int lockstep_run(Chip8Lockstep *lockstep, unsigned long cycles);
+
+bool lockstep_halted(const Chip8Lockstep *lockstep, unsigned int lane);
+
+// Write the state of a lane to the Chip8, as if it had run on its own
+void lockstep_read(const Chip8Lockstep *lockstep, unsigned int lane, Chip8 *chip8);
+
+// Instructions run so far, over all lanes, on the vector and the scalar path
+void lockstep_counts(const Chip8Lockstep *lockstep, unsigned long long *vector, unsigned long long *scalar);
+
+void lockstep_destroy(Chip8Lockstep *lockstep);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef _PACER_H
+#define _PACER_H
+
+#include <stdint.h>
+
+/*
+ * Fixed-rate frame pacing on CLOCK_MONOTONIC. Deadlines are absolute, so sleeping
+ * late never adds up into drift; falling several frames behind skips them instead
+ * of running them back to back.
+ */
+typedef struct
+{
+    int64_t period;   // Nanoseconds between frames
+    int64_t deadline; // Start of the next frame
+    int64_t latest;   // When the previous frame started
+
+    // Jitter statistics: how late each frame started past its deadline
+    unsigned long frames;
+    unsigned long skipped; // Frames dropped after falling behind
+    int64_t jitterMax;
+    double jitterSum;
+} Pacer;
+
+// Nanoseconds on CLOCK_MONOTONIC
+int64_t pacer_now();
+
+void pacer_init(Pacer *pacer, double frequency);
+
+// Sleep until the start of the next frame. Return the seconds passed since the previous one started
+double pacer_wait(Pacer *pacer);
+
+// Return the seconds passed since the previous frame started, and start a new one right away
+double pacer_elapsed(Pacer *pacer);
+
+// Print the jitter statistics to stdout
+void pacer_report(const Pacer *pacer);
+
+#endif
@@ -2,9 +2,11 @@
 #define _RENDERER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 bool gfx_init(int w, int h, unsigned char bg_colour[3], unsigned char fg_colour[3]);
-void gfx_draw(bool gfx[]);
+// Draw the display rows packed as in Chip8.gfx
+void gfx_draw(const uint64_t gfx[]);
 void gfx_destroy();
 
 #endif
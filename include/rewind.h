@@ -0,0 +1,38 @@
+#ifndef _REWIND_H
+#define _REWIND_H
+
+#include <stdbool.h>
+
+#include "chip8.h"
+
+/*
+ * History of a single Chip8, as a ring of snapshots. Only the latest one is kept whole;
+ * every other one is the delta undoing the next: the registers, and the memory pages and
+ * display rows the program changed in between, as tracked by Chip8.dirtyPages and
+ * Chip8.dirtyRows. Both taking a snapshot and going back to one cost as much as that delta.
+ */
+typedef struct Chip8Rewind Chip8Rewind;
+
+// Create a history of up to the given amount of snapshots. Return NULL when out of memory
+Chip8Rewind *rewind_create(Chip8 *chip8, unsigned int length);
+
+/*
+ * Take a snapshot of the Chip8, dropping the oldest ones once the history is full or its
+ * deltas don't fit anymore. Takes over the dirty pages and rows of the Chip8.
+ */
+void rewind_push(Chip8Rewind *rewind);
+
+/*
+ * Restore the latest snapshot and drop it, so each call goes one snapshot further back.
+ * The keypad, the core and the timing configuration are kept. Return false, leaving the
+ * Chip8 untouched, when there's none left. Like after chip8_loadState(), translations
+ * made by the JIT or AOT need jit_flush() or aot_refresh() afterwards.
+ */
+bool rewind_pop(Chip8Rewind *rewind);
+
+// Amount of snapshots in the history
+unsigned int rewind_count(const Chip8Rewind *rewind);
+
+void rewind_destroy(Chip8Rewind *rewind);
+
+#endif
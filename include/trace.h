@@ -0,0 +1,106 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// "C8TR" read as a little endian uint32_t
+#define CHIP8_TRACE_MAGIC 0x52543843
+
+// Version of the trace file format
+#define CHIP8_TRACE_VERSION 1
+
+// Records kept in memory by default, 16MiB worth with their instruction indices
+#define CHIP8_TRACE_CAPACITY (1UL << 20)
+
+/*
+ * Each record is a uint64_t, its highest 4 bits telling its kind:
+ *
+ * - CHIP8_TRACE_INSTRUCTION: an instruction that ran, as its PC in bits 0-11, its opCode in
+ *   bits 12-27, then I, Vx and VF right after it ran in bits 28-43, 44-51 and 52-59.
+ * - CHIP8_TRACE_IDLE: instructions of a spin loop fast-forwarded at once, as the PC of the
+ *   loop in bits 0-11 and the amount of instructions in bits 12-59.
+ * - CHIP8_TRACE_GAP: instructions whose records were lost, as their amount in bits 0-59.
+ */
+#define CHIP8_TRACE_INSTRUCTION 0
+#define CHIP8_TRACE_IDLE 1
+#define CHIP8_TRACE_GAP 2
+
+#define CHIP8_TRACE_KIND(record) ((unsigned int)((record) >> 60))
+
+// Start of a trace file, followed by its records in host byte order
+typedef struct
+{
+    uint32_t magic;   // CHIP8_TRACE_MAGIC
+    uint32_t version; // CHIP8_TRACE_VERSION
+} Chip8TraceHeader;
+
+/*
+ * Ring of the latest records of a Chip8 (see Chip8.trace), written by the thread running
+ * it at the cost of a single store, and optionally streamed to a file by a writer thread
+ * of its own. Records the writer falls too far behind on are overwritten and replaced by
+ * a CHIP8_TRACE_GAP in the file.
+ */
+typedef struct Chip8Trace
+{
+    _Atomic uint64_t *records;
+    _Atomic uint64_t *starts;    // Index of the first instruction of each record, to count those of lost ones
+    unsigned long mask;          // Capacity - 1, the capacity being a power of 2
+    _Atomic unsigned long head; // Records ever written
+    unsigned long instructions; // Instructions ever recorded, by the thread running the Chip8
+
+    // Streaming, the writer thread being the only one touching these
+    FILE *fp;
+    unsigned long tail;    // Records handled by the writer
+    unsigned long written; // Instructions written out or reported lost
+    uint64_t *buffer;
+    uint64_t *bufferStarts;
+    pthread_t writer;
+    atomic_bool stop;
+} Chip8Trace;
+
+/*
+ * Create a ring of at least the given amount of records. With a path, every record is
+ * streamed to that file in the background, else only the latest ones are kept for
+ * trace_dump(). Return NULL, printing why to stderr, on failure.
+ */
+Chip8Trace *trace_create(unsigned long capacity, const char *path);
+
+static inline void trace_record(Chip8Trace *trace, uint64_t record, unsigned long instructions)
+{
+    unsigned long head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+
+    // Seqlock style: a writer seeing this slot replaced sees the head published before it, see trace_flush()
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&trace->records[head & trace->mask], record, memory_order_relaxed);
+    atomic_store_explicit(&trace->starts[head & trace->mask], trace->instructions, memory_order_relaxed);
+    trace->instructions += instructions;
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+static inline void trace_instruction(Chip8Trace *trace, unsigned short pc, unsigned short opCode, unsigned short I, const unsigned char *V)
+{
+    trace_record(trace, (uint64_t)CHIP8_TRACE_INSTRUCTION << 60 | (uint64_t)V[0xF] << 52 | (uint64_t)V[opCode >> 8 & 0xF] << 44 |
+                            (uint64_t)I << 28 | (uint64_t)opCode << 12 | (pc & 0xFFF),
+                 1);
+}
+
+static inline void trace_idle(Chip8Trace *trace, unsigned short pc, unsigned long instructions)
+{
+    trace_record(trace, (uint64_t)CHIP8_TRACE_IDLE << 60 | (uint64_t)instructions << 12 | (pc & 0xFFF), instructions);
+}
+
+/*
+ * Write the records still in the ring to a file, preceded by a CHIP8_TRACE_GAP for the
+ * older ones, while the Chip8 isn't running. Return false, printing why to stderr, when
+ * it can't be written.
+ */
+bool trace_dump(const Chip8Trace *trace, const char *path);
+
+// Stop tracing, writing out whatever is left to stream first
+void trace_destroy(Chip8Trace *trace);
+
+#endif
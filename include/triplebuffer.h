@@ -0,0 +1,39 @@
+#ifndef _TRIPLEBUFFER_H
+#define _TRIPLEBUFFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "chip8.h"
+
+/*
+ * Lock-free hand-off of display frames from one producer thread to one consumer thread.
+ * The producer fills its back buffer and publishes it by swapping it with the spare one;
+ * the consumer takes the spare one when it's fresh. Neither side ever waits for the other,
+ * and the consumer always gets the latest published frame.
+ */
+typedef struct
+{
+    uint64_t frames[3][CHIP8_GFX_H];
+
+    atomic_uint spare;  // Index of the buffer in between, along with TRIPLEBUFFER_FRESH
+    unsigned int back;  // Owned by the producer
+    unsigned int front; // Owned by the consumer
+} TripleBuffer;
+
+void triplebuffer_init(TripleBuffer *buffer);
+
+// Buffer for the producer to write the next frame to
+uint64_t *triplebuffer_back(TripleBuffer *buffer);
+
+// Hand the back buffer over to the consumer
+void triplebuffer_publish(TripleBuffer *buffer);
+
+// Take the latest published frame, if there's one the consumer hasn't taken yet. Return whether there was
+bool triplebuffer_acquire(TripleBuffer *buffer);
+
+// Frame taken by the latest triplebuffer_acquire()
+const uint64_t *triplebuffer_front(const TripleBuffer *buffer);
+
+#endif
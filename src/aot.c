@@ -0,0 +1,114 @@
+#include "../include/aot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+struct Chip8Aot
+{
+    Chip8 *chip8;
+
+    void *handle;
+    const Chip8AotModule *module;
+
+    Chip8AotContext context;
+};
+
+Chip8Aot *aot_load(Chip8 *chip8, const char *path)
+{
+    char localPath[4096];
+
+    // dlopen() searches the library paths for names without a slash
+    if (strchr(path, '/') == NULL)
+    {
+        snprintf(localPath, sizeof(localPath), "./%s", path);
+        path = localPath;
+    }
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+    if (handle == NULL)
+    {
+        fprintf(stderr, "Failed to load the compiled rom '%s': %s\n", path, dlerror());
+        return NULL;
+    }
+
+    const Chip8AotModule *module = dlsym(handle, CHIP8_AOT_SYMBOL);
+
+    if (module == NULL || module->abi != CHIP8_AOT_ABI || module->chip8Size != sizeof(Chip8))
+    {
+        fprintf(stderr, "'%s' wasn't compiled by this version of chip8-aot.\n", path);
+        dlclose(handle);
+        return NULL;
+    }
+
+    // The code is only valid for the exact rom it was compiled from
+    if (module->imageSize > sizeof(chip8->memory) - 512 || memcmp(chip8->memory + 512, module->image, module->imageSize) != 0)
+    {
+        fprintf(stderr, "'%s' was compiled from another rom.\n", path);
+        dlclose(handle);
+        return NULL;
+    }
+
+    Chip8Aot *aot = calloc(1, sizeof(Chip8Aot));
+
+    if (aot == NULL)
+    {
+        dlclose(handle);
+        return NULL;
+    }
+
+    aot->chip8 = chip8;
+    aot->handle = handle;
+    aot->module = module;
+    aot->context.drawSprite = chip8_drawSprite;
+    aot->context.invalidateCode = chip8_invalidateCode;
+    aot->context.random = chip8_random;
+
+    return aot;
+}
+
+static unsigned long aot_run(void *backend, Chip8 *chip8, unsigned long fuel)
+{
+    Chip8Aot *aot = backend;
+
+    aot->context.fuel = fuel;
+    aot->module->run(chip8, &aot->context);
+
+    return fuel - aot->context.fuel;
+}
+
+// Blocks rewritten by the program are left to the interpreter from then on
+static void aot_invalidate(void *backend, unsigned short address, unsigned short length)
+{
+    Chip8Aot *aot = backend;
+
+    aot->module->invalidate(&aot->context, address, length);
+}
+
+Chip8StopReason aot_runFor(Chip8Aot *aot, double deltaTime, unsigned int maxCycles)
+{
+    return chip8_runNative(aot->chip8, deltaTime, maxCycles, aot_run, aot_invalidate, aot);
+}
+
+void aot_refresh(Chip8Aot *aot)
+{
+    const Chip8AotModule *module = aot->module;
+    const unsigned char *program = aot->chip8->memory + 512;
+
+    // Every block is valid again, unless its code differs from the rom it was compiled from
+    memset(aot->context.stale, false, sizeof(aot->context.stale));
+
+    for (unsigned short i = 0; i < module->imageSize; i++)
+    {
+        if (program[i] != module->image[i])
+            module->invalidate(&aot->context, 512 + i, 1);
+    }
+}
+
+void aot_destroy(Chip8Aot *aot)
+{
+    dlclose(aot->handle);
+    free(aot);
+}
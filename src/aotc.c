@@ -0,0 +1,651 @@
+/*
+ * chip8-aot: ahead-of-time compiler turning a rom into C, and optionally into a shared
+ * object the runners load with --aot. The code reachable from 0x200 is found by following
+ * jumps, calls and skips, then split in blocks that run with the same instruction budget
+ * and timing as the interpreter. Anything else (Bnnn targets, Fx0A, rewritten code) is
+ * left to the interpreter at runtime.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../include/aot.h"
+
+#ifndef CHIP8_INCLUDE_DIR
+#    define CHIP8_INCLUDE_DIR "include"
+#endif
+
+#define PROGRAM_SECTION 512
+#define MEMORY_SIZE 4096
+
+// How the compiled code treats each instruction
+typedef enum
+{
+    FLOW_NEXT,      // Continues with the next instruction
+    FLOW_JUMP,      // 1nnn
+    FLOW_CALL,      // 2nnn, which comes back to the next instruction
+    FLOW_RETURN,    // 00EE
+    FLOW_SKIP,      // Continues with either of the next two instructions
+    FLOW_INDIRECT,  // Bnnn, whose target is only known at runtime
+    FLOW_LEAVE,     // Hands control back to the runner afterwards (draws, sound timer, memory writes)
+    FLOW_INTERPRET, // Fx0A, left to the interpreter
+    FLOW_INVALID,   // Halts the machine, also through the interpreter
+} Flow;
+
+typedef struct
+{
+    unsigned char rom[MEMORY_SIZE - PROGRAM_SECTION];
+    int romSize;
+
+    bool entry[MEMORY_SIZE];   // Known start of some code, besides 0x200
+    bool reached[MEMORY_SIZE];
+    bool leader[MEMORY_SIZE];     // Some block starts here
+    unsigned short owner[MEMORY_SIZE]; // Start of the block holding the instruction at each address, 0 for none
+} Program;
+
+bool readRom(const char *path, Program *program);
+void discover(Program *program);
+void emitProgram(const Program *program, const char *romPath, FILE *out);
+bool compileShared(const char *cc, const char *includeDir, const char *source, const char *output);
+
+// Whether the whole opCode at the address is part of the rom
+static bool inRom(const Program *program, unsigned int address)
+{
+    return address >= PROGRAM_SECTION && address + 1 < PROGRAM_SECTION + (unsigned int)program->romSize;
+}
+
+static unsigned short opCodeAt(const Program *program, unsigned int address)
+{
+    return program->rom[address - PROGRAM_SECTION] << 8 | program->rom[address - PROGRAM_SECTION + 1];
+}
+
+// Decoded exactly like the core does, so the same opCodes are invalid
+static Flow flowOf(unsigned short opCode)
+{
+    unsigned char kk = opCode & 0x00FF;
+
+    switch (opCode >> 12)
+    {
+    case 0x0:
+        if (kk == 0xE0)
+            return FLOW_LEAVE;
+        return kk == 0xEE ? FLOW_RETURN : FLOW_INVALID;
+
+    case 0x1: return FLOW_JUMP;
+    case 0x2: return FLOW_CALL;
+    case 0x3: case 0x4: case 0x5: case 0x9: return FLOW_SKIP;
+    case 0x6: case 0x7: case 0xA: case 0xC: return FLOW_NEXT;
+    case 0xB: return FLOW_INDIRECT;
+    case 0xD: return FLOW_LEAVE;
+
+    case 0x8:
+        switch (opCode & 0x000F)
+        {
+        case 0x0: case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x6: case 0x7: case 0xE:
+            return FLOW_NEXT;
+        }
+        return FLOW_INVALID;
+
+    case 0xE:
+        return kk == 0x9E || kk == 0xA1 ? FLOW_SKIP : FLOW_INVALID;
+
+    case 0xF:
+        switch (kk)
+        {
+        case 0x07: case 0x15: case 0x1E: case 0x29: case 0x65: return FLOW_NEXT;
+        case 0x18: case 0x33: case 0x55: return FLOW_LEAVE;
+        case 0x0A: return FLOW_INTERPRET;
+        }
+        return FLOW_INVALID;
+    }
+
+    return FLOW_INVALID;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *cc = getenv("CC") != NULL ? getenv("CC") : "cc";
+    const char *includeDir = CHIP8_INCLUDE_DIR;
+    const char *output = NULL;
+    const char *romPath = NULL;
+    static Program program; // Filled by the arguments too
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+
+        // [--cc <compiler>]
+        if (strcmp(argv[i], "--cc") == 0 && hasValue)
+        {
+            cc = argv[++i];
+            continue;
+        }
+
+        // [--include <dir>]
+        if (strcmp(argv[i], "--include") == 0 && hasValue)
+        {
+            includeDir = argv[++i];
+            continue;
+        }
+
+        // [--entry <address>], for code only reached through Bnnn
+        if (strcmp(argv[i], "--entry") == 0 && hasValue)
+        {
+            unsigned long address = strtoul(argv[++i], NULL, 16);
+
+            if (address < PROGRAM_SECTION || address >= MEMORY_SIZE)
+            {
+                fprintf(stderr, "Error: --entry requires a hex address inside the program.\n");
+                exit(EXIT_FAILURE);
+            }
+
+            program.entry[address] = true;
+            continue;
+        }
+
+        // -o <file.c|file.so>
+        if (strcmp(argv[i], "-o") == 0 && hasValue)
+        {
+            output = argv[++i];
+            continue;
+        }
+
+        romPath = argv[i];
+    }
+
+    if (romPath == NULL || output == NULL)
+    {
+        fprintf(stderr, "Usage: %s [--cc <compiler>] [--include <dir>] [--entry <hex address>]... -o <file.c|file.so> ROM\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!readRom(romPath, &program))
+        exit(EXIT_FAILURE);
+
+    discover(&program);
+
+    size_t length = strlen(output);
+    bool shared = length > 3 && strcmp(output + length - 3, ".so") == 0;
+
+    // Shared objects are built from a temporary translation unit
+    char source[] = "/tmp/chip8-aot-XXXXXX.c";
+    FILE *out;
+
+    if (shared)
+    {
+        int fd = mkstemps(source, 2);
+        out = fd == -1 ? NULL : fdopen(fd, "w");
+    }
+    else
+    {
+        out = fopen(output, "w");
+    }
+
+    if (out == NULL)
+    {
+        fprintf(stderr, "Error: Failed to create '%s'.\n", shared ? source : output);
+        exit(EXIT_FAILURE);
+    }
+
+    emitProgram(&program, romPath, out);
+    fclose(out);
+
+    if (shared)
+    {
+        bool compiled = compileShared(cc, includeDir, source, output);
+
+        unlink(source);
+
+        if (!compiled)
+            exit(EXIT_FAILURE);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+bool readRom(const char *path, Program *program)
+{
+    FILE *fp = fopen(path, "rb");
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Failed to open file '%s'.\n", path);
+        return false;
+    }
+
+    program->romSize = fread(program->rom, 1, sizeof(program->rom), fp);
+
+    // Same limit as chip8_loadGame()
+    if (fgetc(fp) != EOF)
+    {
+        fprintf(stderr, "File '%s' doesn't fit in the memory.\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+// Addresses past the memory are left to the interpreter, which reports them
+static void markLeader(Program *program, unsigned int address)
+{
+    if (address < MEMORY_SIZE)
+        program->leader[address] = true;
+}
+
+// Find the code reachable from the start of the program, and where each of its blocks begins
+void discover(Program *program)
+{
+    static unsigned short pending[MEMORY_SIZE * 4];
+    int pendingCount = 0;
+    int reachedCount = 0;
+    int compiledCount = 0;
+    int blockCount = 0;
+
+    pending[pendingCount++] = PROGRAM_SECTION;
+    markLeader(program, PROGRAM_SECTION);
+
+    for (unsigned int address = 0; address < MEMORY_SIZE; address++)
+    {
+        if (program->entry[address])
+        {
+            pending[pendingCount++] = address;
+            markLeader(program, address);
+        }
+    }
+
+    while (pendingCount > 0)
+    {
+        unsigned short address = pending[--pendingCount];
+
+        if (!inRom(program, address) || program->reached[address])
+            continue;
+
+        program->reached[address] = true;
+
+        unsigned short opCode = opCodeAt(program, address);
+        unsigned short nnn = opCode & 0x0FFF;
+        unsigned int next = address + 2;
+
+        switch (flowOf(opCode))
+        {
+        case FLOW_NEXT:
+            pending[pendingCount++] = next;
+            break;
+
+        case FLOW_JUMP:
+            pending[pendingCount++] = nnn;
+            markLeader(program, nnn);
+            break;
+
+        case FLOW_CALL:
+            pending[pendingCount++] = nnn;
+            pending[pendingCount++] = next;
+            markLeader(program, nnn);
+            markLeader(program, next);
+            break;
+
+        case FLOW_SKIP:
+            pending[pendingCount++] = next;
+            pending[pendingCount++] = next + 2;
+            markLeader(program, next);
+            markLeader(program, next + 2);
+            break;
+
+        case FLOW_LEAVE:
+        case FLOW_INTERPRET:
+            // The runner comes back to the compiled code right after them
+            pending[pendingCount++] = next;
+            markLeader(program, next);
+            break;
+
+        case FLOW_INDIRECT:
+            fprintf(stderr, "Note: Bnnn at 0x%03X jumps to V0 + 0x%03X, only known at runtime. Code reached only from there runs in the interpreter, unless given with --entry.\n",
+                    address, nnn);
+            break;
+
+        case FLOW_RETURN:
+        case FLOW_INVALID:
+            break;
+        }
+    }
+
+    // Each block runs from its leader until the next one or the first instruction that doesn't fall through
+    for (unsigned int address = PROGRAM_SECTION; address < MEMORY_SIZE; address++)
+    {
+        if (!program->reached[address])
+            continue;
+
+        reachedCount++;
+
+        if (flowOf(opCodeAt(program, address)) >= FLOW_INTERPRET)
+            continue;
+
+        compiledCount++;
+
+        if (program->leader[address])
+        {
+            program->owner[address] = address;
+            blockCount++;
+        }
+        else if (address >= PROGRAM_SECTION + 2 && program->owner[address - 2] != 0 &&
+                 flowOf(opCodeAt(program, address - 2)) == FLOW_NEXT)
+        {
+            program->owner[address] = program->owner[address - 2];
+        }
+    }
+
+    // Drop the leaders that didn't get a block, they're entered through the interpreter
+    for (unsigned int address = 0; address < MEMORY_SIZE; address++)
+        program->leader[address] = program->owner[address] == address && address != 0;
+
+    fprintf(stderr, "%d blocks, %d of %d reachable instructions compiled\n", blockCount, compiledCount, reachedCount);
+}
+
+// Statement continuing at the given address: its block, or the runner when it has none
+static void emitGoto(const Program *program, FILE *out, unsigned int address)
+{
+    if (address < MEMORY_SIZE && program->leader[address])
+        fprintf(out, "goto b_%03X;", address);
+    else
+        fprintf(out, "{ c->PC = 0x%03X; goto leave; }", address);
+}
+
+// Leave right before the instruction, giving back the fuel of the part of the block not run
+static void emitBail(FILE *out, unsigned int address, int refund, const char *condition)
+{
+    fprintf(out, "    if (%s) { fuel += %d; c->PC = 0x%03X; goto leave; }\n", condition, refund, address);
+}
+
+static void emitInstruction(const Program *program, FILE *out, unsigned int address, int refund)
+{
+    unsigned short opCode = opCodeAt(program, address);
+    unsigned char x = (opCode & 0x0F00) >> 8;
+    unsigned char y = (opCode & 0x00F0) >> 4;
+    unsigned char kk = opCode & 0x00FF;
+    unsigned short nnn = opCode & 0x0FFF;
+    unsigned int next = address + 2;
+
+    fprintf(out, "    // %03X: %04X\n", address, opCode);
+
+    switch (opCode >> 12)
+    {
+    case 0x0:
+        if (kk == 0xE0)
+        {
+            fprintf(out, "    memset(c->gfx, false, sizeof(c->gfx));\n");
+            fprintf(out, "    c->dirtyRows = UINT32_MAX;\n");
+            fprintf(out, "    c->drawFlag = true;\n");
+            fprintf(out, "    c->PC = 0x%03X;\n    goto leave;\n", next);
+        }
+        else
+        {
+            emitBail(out, address, refund, "c->SP <= 0");
+            fprintf(out, "    c->SP--;\n");
+            fprintf(out, "    c->PC = c->stack[c->SP] + 2;\n    goto dispatch;\n");
+        }
+        return;
+
+    case 0x1:
+        fprintf(out, "    ");
+        emitGoto(program, out, nnn);
+        fprintf(out, "\n");
+        return;
+
+    case 0x2:
+        emitBail(out, address, refund, "c->SP >= 15");
+        fprintf(out, "    c->stack[c->SP] = 0x%03X;\n    c->SP++;\n    ", address);
+        emitGoto(program, out, nnn);
+        fprintf(out, "\n");
+        return;
+
+    case 0x3: fprintf(out, "    if (c->V[%d] == 0x%02X) ", x, kk); break;
+    case 0x4: fprintf(out, "    if (c->V[%d] != 0x%02X) ", x, kk); break;
+    case 0x5: fprintf(out, "    if (c->V[%d] == c->V[%d]) ", x, y); break;
+    case 0x9: fprintf(out, "    if (c->V[%d] != c->V[%d]) ", x, y); break;
+
+    case 0x6: fprintf(out, "    c->V[%d] = 0x%02X;\n", x, kk); return;
+    case 0x7: fprintf(out, "    c->V[%d] += 0x%02X;\n", x, kk); return;
+
+    case 0x8:
+        switch (opCode & 0x000F)
+        {
+        case 0x0: fprintf(out, "    c->V[%d] = c->V[%d];\n", x, y); return;
+        case 0x1: fprintf(out, "    c->V[%d] |= c->V[%d];\n", x, y); return;
+        case 0x2: fprintf(out, "    c->V[%d] &= c->V[%d];\n", x, y); return;
+        case 0x3: fprintf(out, "    c->V[%d] ^= c->V[%d];\n", x, y); return;
+        case 0x4: fprintf(out, "    vf = c->V[%d] + c->V[%d] > 0xFF;\n    c->V[%d] += c->V[%d];\n", x, y, x, y); break;
+        case 0x5: fprintf(out, "    vf = c->V[%d] >= c->V[%d];\n    c->V[%d] -= c->V[%d];\n", x, y, x, y); break;
+        case 0x7: fprintf(out, "    vf = c->V[%d] >= c->V[%d];\n    c->V[%d] = c->V[%d] - c->V[%d];\n", y, x, x, y, x); break;
+
+        case 0x6:
+        case 0xE:
+            fprintf(out, "    if (!c->shiftQuirk)\n        c->V[%d] = c->V[%d];\n", x, y);
+
+            if ((opCode & 0x000F) == 0x6)
+                fprintf(out, "    vf = c->V[%d] & 1;\n    c->V[%d] >>= 1;\n", x, x);
+            else
+                fprintf(out, "    vf = c->V[%d] >> 7;\n    c->V[%d] <<= 1;\n", x, x);
+            break;
+        }
+
+        fprintf(out, "    c->V[0xF] = vf;\n");
+        return;
+
+    case 0xA: fprintf(out, "    c->I = 0x%03X;\n", nnn); return;
+
+    case 0xB:
+        fprintf(out, "    c->PC = c->V[0] + 0x%03X;\n    goto dispatch;\n", nnn);
+        return;
+
+    case 0xC: fprintf(out, "    c->V[%d] = context->random(c) & 0x%02X;\n", x, kk); return;
+
+    case 0xD:
+        fprintf(out, "    c->V[0xF] = context->drawSprite(c, c->V[%d], c->V[%d], %d, c->I);\n", x, y, kk & 0x0F);
+        fprintf(out, "    c->drawFlag = true;\n");
+        fprintf(out, "    c->PC = 0x%03X;\n    goto leave;\n", next);
+        return;
+
+    case 0xE: fprintf(out, kk == 0x9E ? "    if (c->key[c->V[%d] & 0xF]) " : "    if (!c->key[c->V[%d] & 0xF]) ", x); break;
+
+    case 0xF:
+        switch (kk)
+        {
+        case 0x07: fprintf(out, "    c->V[%d] = c->dt;\n", x); return;
+        case 0x15: fprintf(out, "    c->dt = c->V[%d];\n", x); return;
+        case 0x1E: fprintf(out, "    c->I += c->V[%d];\n", x); return;
+        case 0x29: fprintf(out, "    c->I = c->V[%d] * 5;\n", x); return;
+
+        case 0x18:
+            fprintf(out, "    c->st = c->V[%d];\n", x);
+            fprintf(out, "    c->PC = 0x%03X;\n    goto leave;\n", next);
+            return;
+
+        case 0x65:
+            for (int i = 0; i <= x; i++)
+                fprintf(out, "    c->V[%d] = c->memory[(c->I + %d) & 0x0FFF];\n", i, i);
+            return;
+
+        case 0x33:
+        case 0x55:
+            if (kk == 0x33)
+            {
+                fprintf(out, "    c->memory[c->I & 0x0FFF] = c->V[%d] / 100;\n", x);
+                fprintf(out, "    c->memory[(c->I + 1) & 0x0FFF] = (c->V[%d] / 10) %% 10;\n", x);
+                fprintf(out, "    c->memory[(c->I + 2) & 0x0FFF] = (c->V[%d] %% 100) %% 10;\n", x);
+            }
+            else
+            {
+                for (int i = 0; i <= x; i++)
+                    fprintf(out, "    c->memory[(c->I + %d) & 0x0FFF] = c->V[%d];\n", i, i);
+            }
+
+            // The rest of the block might be what was just written
+            fprintf(out, "    context->invalidateCode(c, c->I & 0x0FFF, %d);\n", kk == 0x33 ? 3 : x + 1);
+            fprintf(out, "    if (invalidate(context, c->I & 0x0FFF, %d)) { c->PC = 0x%03X; goto leave; }\n    ",
+                    kk == 0x33 ? 3 : x + 1, next);
+            emitGoto(program, out, next);
+            fprintf(out, "\n");
+            return;
+        }
+    }
+
+    // Skips
+    emitGoto(program, out, next + 2);
+    fprintf(out, "\n    ");
+    emitGoto(program, out, next);
+    fprintf(out, "\n");
+}
+
+void emitProgram(const Program *program, const char *romPath, FILE *out)
+{
+    fprintf(out, "// Generated by chip8-aot from '%s'\n\n", romPath);
+
+#ifdef CHIP8_PROFILE
+    // Same layout of the Chip8 as the emulator loading it
+    fprintf(out, "#define CHIP8_PROFILE\n\n");
+#endif
+    fprintf(out, "#include <stdlib.h>\n#include <string.h>\n\n#include \"chip8.h\"\n#include \"aot.h\"\n\n");
+
+    fprintf(out, "static const unsigned char image[%d] = {", program->romSize > 0 ? program->romSize : 1);
+
+    for (int i = 0; i < program->romSize; i++)
+        fprintf(out, "%s0x%02X,", i % 16 == 0 ? "\n    " : " ", program->rom[i]);
+
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "// Block holding the instruction starting at each address, 0 for none\n");
+    fprintf(out, "static const unsigned short owner[4096] = {");
+
+    for (unsigned int address = 0; address < MEMORY_SIZE; address++)
+    {
+        if (program->owner[address] != 0)
+            fprintf(out, "\n    [0x%03X] = 0x%03X,", address, program->owner[address]);
+    }
+
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out,
+            "static bool invalidate(Chip8AotContext *context, unsigned short address, unsigned short length)\n"
+            "{\n"
+            "    bool hit = false;\n"
+            "\n"
+            "    // The instruction starting one byte before the address also holds the first written byte\n"
+            "    for (unsigned int i = 0; i <= length; i++)\n"
+            "    {\n"
+            "        unsigned short block = owner[(address - 1 + i) & 0x0FFF];\n"
+            "\n"
+            "        if (block != 0 && !context->stale[block])\n"
+            "        {\n"
+            "            context->stale[block] = true;\n"
+            "            hit = true;\n"
+            "        }\n"
+            "    }\n"
+            "\n"
+            "    return hit;\n"
+            "}\n\n");
+
+    fprintf(out,
+            "static void run(Chip8 *c, Chip8AotContext *context)\n"
+            "{\n"
+            "    long fuel = context->fuel;\n"
+            "    const bool *stale = context->stale;\n"
+            "    unsigned char vf;\n"
+            "\n"
+            "    (void)vf;\n"
+            "    c->drawFlag = false;\n"
+            "\n"
+            "dispatch:\n"
+            "    switch (c->PC)\n"
+            "    {\n");
+
+    for (unsigned int address = 0; address < MEMORY_SIZE; address++)
+    {
+        if (program->leader[address])
+            fprintf(out, "    case 0x%03X: goto b_%03X;\n", address, address);
+    }
+
+    fprintf(out, "    }\n    goto leave;\n");
+
+    for (unsigned int start = 0; start < MEMORY_SIZE; start++)
+    {
+        if (!program->leader[start])
+            continue;
+
+        int length = 0;
+
+        while (start + length * 2 < MEMORY_SIZE && program->owner[start + length * 2] == start)
+            length++;
+
+        fprintf(out, "\nb_%03X:\n", start);
+        fprintf(out, "    if (fuel < %d || stale[0x%03X]) { c->PC = 0x%03X; goto leave; }\n", length, start, start);
+        fprintf(out, "    fuel -= %d;\n", length);
+
+        for (int i = 0; i < length; i++)
+            emitInstruction(program, out, start + i * 2, length - i);
+
+        // Falls into the next block
+        unsigned int last = start + (length - 1) * 2;
+
+        if (flowOf(opCodeAt(program, last)) == FLOW_NEXT)
+        {
+            fprintf(out, "    ");
+            emitGoto(program, out, last + 2);
+            fprintf(out, "\n");
+        }
+    }
+
+    fprintf(out,
+            "\nleave:\n"
+            "    context->fuel = fuel;\n"
+            "}\n\n");
+
+    fprintf(out,
+            "const Chip8AotModule chip8_aotModule = {\n"
+            "    .abi = CHIP8_AOT_ABI,\n"
+            "    .chip8Size = sizeof(Chip8),\n"
+            "    .image = image,\n"
+            "    .imageSize = %d,\n"
+            "    .run = run,\n"
+            "    .invalidate = invalidate,\n"
+            "};\n",
+            program->romSize);
+}
+
+// Build the generated translation unit into a shared object with the host compiler
+bool compileShared(const char *cc, const char *includeDir, const char *source, const char *output)
+{
+    char include[4096];
+
+    snprintf(include, sizeof(include), "-I%s", includeDir);
+
+    pid_t pid = fork();
+
+    if (pid == -1)
+    {
+        fprintf(stderr, "Error: Failed to start the compiler.\n");
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        execlp(cc, cc, "-O2", "-shared", "-fPIC", include, "-o", output, source, (char *)NULL);
+        fprintf(stderr, "Error: Failed to run '%s'.\n", cc);
+        _exit(127);
+    }
+
+    int status;
+
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "Error: '%s' failed to compile '%s'.\n", cc, output);
+        return false;
+    }
+
+    return true;
+}
@@ -1,4 +1,5 @@
 #include <math.h>
+#include <string.h>
 
 #include "../include/audio.h"
 #include <SDL2/SDL.h>
@@ -8,14 +9,19 @@
 #    define M_PI 3.14159265358979323846
 #endif
 
+// Entries of the wavetable holding one cycle of the tone, indexed by the top bits of the phase
+#define AUDIO_TABLE_BITS 8
+#define AUDIO_TABLE_SIZE (1 << AUDIO_TABLE_BITS)
+
 // Attributes for describing the sound samples
 typedef struct
 {
-    double sineFreq;
-    double sampleRate;
-    double samplesPerSineCycle;
-    double amplitude;
-    uint32_t samplePos;
+    Uint8 table[AUDIO_TABLE_SIZE];
+    uint32_t phase; // Position within the cycle, a whole cycle being 2^32
+    uint32_t step;  // Phase advanced by each sample
+    Uint8 silence;
+    bool playing;   // Whether the latest buffer ended in the middle of the tone
+    const atomic_bool *sounding;
 } Sound;
 
 Sound sound;
@@ -23,7 +29,7 @@ SDL_AudioDeviceID audio_device;
 
 void SDLAudioCallback(void *data, Uint8 *buffer, int length);
 
-bool audio_init(double sine_frequency)
+bool audio_init(double sine_frequency, const atomic_bool *sounding)
 {
     if (SDL_Init(SDL_INIT_AUDIO) != 0)
     {
@@ -31,37 +37,46 @@ bool audio_init(double sine_frequency)
         return false;
     }
 
-    // Avoid undesired values for sine_frequency
-    if (isnan(sine_frequency) || isinf(sine_frequency) || sine_frequency == 0) {
+    double sampleRate = 44100;
+
+    // Avoid undesired values for sine_frequency, up to the highest the sample rate can carry
+    if (isnan(sine_frequency) || isinf(sine_frequency) || sine_frequency == 0 || fabs(sine_frequency) >= sampleRate / 2) {
         printf("'%f' is not a valid value for the sound frequency. Using 264 instead.\n", sine_frequency);
         sine_frequency = 264.0;
     }
 
-    // Set the values to used for calculating each sample
-    sound.sineFreq = sine_frequency;
-    sound.sampleRate = 44100;
-    sound.samplesPerSineCycle = sound.sampleRate / sound.sineFreq;
-    sound.samplePos = 0;
-    sound.amplitude = 127.5;
+    // One cycle of a sine wave, read at the step the frequency needs instead of computing every sample
+    for (int i = 0; i < AUDIO_TABLE_SIZE; i++)
+        sound.table[i] = (sin(i * M_PI * 2 / AUDIO_TABLE_SIZE) + 1) * 127.5;
+
+    sound.phase = 0;
+    sound.step = fabs(sine_frequency) / sampleRate * 4294967296.0;
+    sound.playing = false;
+    sound.sounding = sounding;
 
     SDL_AudioSpec desiredSpec, obtainedSpec;
 
     SDL_zero(desiredSpec); // Clear memory block
-    desiredSpec.freq = sound.sampleRate; // Samples per second
+    desiredSpec.freq = sampleRate; // Samples per second
     desiredSpec.format = AUDIO_U8; // Unsigned 8-bit samples
     desiredSpec.channels = 1; // Mono
-    desiredSpec.samples = 2048; // Buffer size
+    desiredSpec.samples = 512; // Buffer size, bounding how late the tone starts and stops
     desiredSpec.callback = SDLAudioCallback; // Callback that will feed the audio device
     desiredSpec.userdata = &sound; // Data to be used by the callback function. userdata is used to calculate the samples.
 
-    // Try to open the most reasonable default device for playback
-    audio_device = SDL_OpenAudioDevice(NULL, 0, &desiredSpec, &obtainedSpec, SDL_AUDIO_ALLOW_FORMAT_CHANGE);
+    // Try to open the most reasonable default device for playback, SDL converting from the samples written
+    audio_device = SDL_OpenAudioDevice(NULL, 0, &desiredSpec, &obtainedSpec, 0);
     if (audio_device == 0)
     {
         printf("Failed to open audio: %s\n", SDL_GetError());
         return false;
     }
 
+    sound.silence = obtainedSpec.silence;
+
+    // The device keeps playing, silence while the flag is clear
+    SDL_PauseAudioDevice(audio_device, 0);
+
     return true;
 }
 
@@ -69,23 +84,27 @@ bool audio_init(double sine_frequency)
 void SDLAudioCallback(void *data, Uint8 *buffer, int length)
 {
     Sound *sound = (Sound *)(data); // Convert data to Sound type
+    bool sounding = atomic_load_explicit(sound->sounding, memory_order_relaxed);
+    int i = 0;
 
-    // Calculate each sample value according to attributes in "data" (Sound struct), describing a sine wave
-    for (int i = 0; i < length; ++i)
+    // The tone starts at the beginning of a cycle and stops at the end of one, so neither clicks
+    if (sounding && !sound->playing)
     {
-        buffer[i] = (sin(sound->samplePos / sound->samplesPerSineCycle * M_PI * 2) + 1) * sound->amplitude;
-        ++sound->samplePos;
+        sound->playing = true;
+        sound->phase = 0;
     }
-}
 
-void audio_play()
-{
-    SDL_PauseAudioDevice(audio_device, 0);
-}
+    for (; i < length && sound->playing; i++)
+    {
+        buffer[i] = sound->table[sound->phase >> (32 - AUDIO_TABLE_BITS)];
+        sound->phase += sound->step;
 
-void audio_stop()
-{
-    SDL_PauseAudioDevice(audio_device, 1);
+        // The phase wrapped around, ending a cycle
+        if (!sounding && sound->phase < sound->step)
+            sound->playing = false;
+    }
+
+    memset(buffer + i, sound->silence, length - i);
 }
 
 void audio_destroy()
@@ -0,0 +1,753 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "../include/chip8.h"
+#include "../include/jit.h"
+#include "../include/aot.h"
+#include "../include/input.h"
+#include "../include/trace.h"
+
+// Max amount of key transitions read from an input script
+#define MAX_INPUT_EVENTS 65536
+
+// Key transition applied right before the instruction at the given cycle runs
+typedef struct
+{
+    unsigned long cycle;
+    unsigned char key;
+    bool pressed;
+} InputEvent;
+
+// Parameters shared by every run
+typedef struct
+{
+    unsigned long cycles;
+    int processorFreq;
+    bool shiftQuirk;
+    Chip8CostModel costModel;
+    uint64_t seed;
+    Chip8Core core;
+    bool jit; // Run through the JIT when the host supports it, else through the interpreter
+    const char *aotDir; // Directory with the roms compiled by chip8-aot, as <rom name>.so. NULL for none
+    const char *traceDir; // Directory to write the latest instructions of the failed runs to, as <rom name>.trace. NULL for none
+    InputEvent *inputs;
+    int inputCount;
+    const uint64_t *expectedGfx; // Display the runs must end with, as recorded along with the input. NULL for any
+#ifdef CHIP8_PROFILE
+    const char *profilePrefix; // Write the profile of every run to <prefix>.json and <prefix>.folded. NULL for none
+#endif
+} RunParams;
+
+typedef struct
+{
+    const char *rom;
+    bool loaded;
+    bool failed; // Halted by an invalid opCode, stack fault or PC out of memory
+    bool diverged; // Ended with another display than the recorded one
+    uint64_t gfxHash;
+    unsigned long cycles;
+    double wallTime;
+#ifdef CHIP8_PROFILE
+    Chip8Profile *profile; // Copy taken at the end of the run, NULL when not profiling
+#endif
+} RunResult;
+
+/*
+ * Range of job indexes owned by a worker, packed as (end << 32 | begin).
+ * The owner takes jobs from the beginning and idle workers steal half of
+ * what's left from the end, both through a compare-and-swap on the whole range.
+ */
+typedef struct
+{
+    _Atomic uint64_t range;
+    char padding[64 - sizeof(uint64_t)]; // Keep each range on its own cache line
+} WorkQueue;
+
+typedef struct
+{
+    int id;
+    int workerCount;
+    WorkQueue *queues;
+    const RunParams *params;
+    RunResult *results;
+} Worker;
+
+bool parseArgs(int argc, char *argv[], RunParams *params, int *threads, char ***roms, int *romCount);
+bool readRomList(const char *file, char ***roms, int *romCount);
+bool readInputScript(const char *file, RunParams *params);
+bool readInputLog(const char *file, RunParams *params);
+#ifdef CHIP8_PROFILE
+bool writeProfiles(const char *prefix, const RunResult *results, int romCount);
+#endif
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// FNV-1a hash of the display rows, from their leftmost pixels so it doesn't depend on the host byte order
+uint64_t hashGfx(const Chip8 *chip8)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (int row = 0; row < CHIP8_GFX_H; row++)
+    {
+        for (int shift = CHIP8_GFX_W - 8; shift >= 0; shift -= 8)
+        {
+            hash ^= (chip8->gfx[row] >> shift) & 0xFF;
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    return hash;
+}
+
+// Path of <dir>/<rom name without extension><extension>. Return false when it doesn't fit
+bool romFilePath(const char *dir, const char *rom, const char *extension, char *path, size_t size)
+{
+    const char *name = strrchr(rom, '/') != NULL ? strrchr(rom, '/') + 1 : rom;
+    const char *romExtension = strrchr(name, '.');
+    int nameLength = romExtension != NULL ? (int)(romExtension - name) : (int)strlen(name);
+
+    return snprintf(path, size, "%s/%.*s%s", dir, nameLength, name, extension) < (int)size;
+}
+
+// Path of <dir>/<rom name without extension>.so. Return false when there's no such file
+bool compiledRomPath(const char *dir, const char *rom, char *path, size_t size)
+{
+    return romFilePath(dir, rom, ".so", path, size) && access(path, R_OK) == 0;
+}
+
+void runRom(Chip8 *chip8, const RunParams *params, RunResult *result)
+{
+    double start = now();
+    int nextInput = 0;
+    unsigned long sliceEnd;
+    Chip8Jit *jit = NULL;
+    Chip8Aot *aot = NULL;
+    char aotPath[4096];
+    Chip8StopReason reason;
+
+    chip8_init(chip8, params->processorFreq);
+    chip8_setCostModel(chip8, params->costModel);
+    chip8_seed(chip8, params->seed);
+    chip8->shiftQuirk = params->shiftQuirk;
+    chip8->core = params->core;
+
+    result->loaded = chip8_loadGame(chip8, (char *)result->rom);
+    result->failed = false;
+
+    // Kept in memory only, and written out if the run goes wrong. Every instruction then goes through the interpreter
+    if (result->loaded && params->traceDir != NULL)
+        chip8->trace = trace_create(CHIP8_TRACE_CAPACITY, NULL);
+
+    // Roms without a compiled version run on the selected core
+    if (result->loaded && params->aotDir != NULL && compiledRomPath(params->aotDir, result->rom, aotPath, sizeof(aotPath)))
+        aot = aot_load(chip8, aotPath);
+
+    if (result->loaded && aot == NULL && params->jit)
+        jit = jit_create(chip8);
+
+    while (result->loaded && chip8->cycles < params->cycles)
+    {
+        // Apply every key transition scheduled for this cycle
+        while (nextInput < params->inputCount && params->inputs[nextInput].cycle <= chip8->cycles)
+        {
+            chip8->key[params->inputs[nextInput].key] = params->inputs[nextInput].pressed;
+            nextInput++;
+        }
+
+        // Run until the next key transition or the end of the session
+        sliceEnd = params->cycles;
+
+        if (nextInput < params->inputCount && params->inputs[nextInput].cycle < sliceEnd)
+            sliceEnd = params->inputs[nextInput].cycle;
+
+        /*
+         * The program only observes the virtual clock, so the budget can be as large as
+         * it gets and maxCycles is what actually bounds the slice, running it as fast as
+         * the host allows.
+         */
+        chip8->budget = LONG_MAX;
+
+        if (aot != NULL)
+            reason = aot_runFor(aot, 0, sliceEnd - chip8->cycles);
+        else if (jit != NULL)
+            reason = jit_runFor(jit, 0, sliceEnd - chip8->cycles);
+        else
+            reason = chip8_runFor(chip8, 0, sliceEnd - chip8->cycles);
+
+        if (reason == CHIP8_STOP_ERROR)
+        {
+            result->failed = true;
+            break;
+        }
+    }
+
+    if (jit != NULL)
+        jit_destroy(jit);
+
+    if (aot != NULL)
+        aot_destroy(aot);
+
+    result->cycles = chip8->cycles;
+    result->gfxHash = hashGfx(chip8);
+    result->diverged = result->loaded && params->expectedGfx != NULL && memcmp(chip8->gfx, params->expectedGfx, sizeof(chip8->gfx)) != 0;
+    result->wallTime = now() - start;
+
+    if (chip8->trace != NULL)
+    {
+        char tracePath[4096];
+
+        if ((result->failed || result->diverged) && romFilePath(params->traceDir, result->rom, ".trace", tracePath, sizeof(tracePath)))
+            trace_dump(chip8->trace, tracePath);
+
+        trace_destroy(chip8->trace);
+        chip8->trace = NULL;
+    }
+
+#ifdef CHIP8_PROFILE
+    if (params->profilePrefix != NULL && (result->profile = malloc(sizeof(Chip8Profile))) != NULL)
+        memcpy(result->profile, &chip8->profile, sizeof(Chip8Profile));
+#endif
+}
+
+// Take the next job from the worker's own range. Return -1 when it's empty
+long popJob(WorkQueue *queue)
+{
+    uint64_t range = atomic_load(&queue->range);
+
+    while ((uint32_t)range < (uint32_t)(range >> 32))
+    {
+        if (atomic_compare_exchange_weak(&queue->range, &range, range + 1))
+            return (uint32_t)range;
+    }
+
+    return -1;
+}
+
+// Move half of the jobs left in another worker's range into the given worker's range
+bool stealJobs(Worker *worker)
+{
+    for (int i = 1; i < worker->workerCount; i++)
+    {
+        WorkQueue *victim = &worker->queues[(worker->id + i) % worker->workerCount];
+        uint64_t range = atomic_load(&victim->range);
+
+        while (true)
+        {
+            uint32_t begin = (uint32_t)range;
+            uint32_t end = (uint32_t)(range >> 32);
+
+            if (begin >= end)
+                break;
+
+            uint32_t split = end - (end - begin + 1) / 2;
+
+            if (atomic_compare_exchange_weak(&victim->range, &range, (uint64_t)split << 32 | begin))
+            {
+                atomic_store(&worker->queues[worker->id].range, (uint64_t)end << 32 | split);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void *workerLoop(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    Chip8 *chip8 = malloc(sizeof(Chip8));
+    long job;
+
+    if (chip8 == NULL)
+    {
+        fprintf(stderr, "Worker %d failed to allocate a Chip8.\n", worker->id);
+        return NULL;
+    }
+
+    do
+    {
+        while ((job = popJob(&worker->queues[worker->id])) >= 0)
+            runRom(chip8, worker->params, &worker->results[job]);
+    } while (stealJobs(worker));
+
+    free(chip8);
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    RunParams params = {.cycles = 1000000, .processorFreq = 700, .shiftQuirk = true, .costModel = CHIP8_COST_FLAT, .seed = 0, .core = CHIP8_CORE_INTERPRETER, .jit = false, .aotDir = NULL, .traceDir = NULL, .inputs = NULL, .inputCount = 0, .expectedGfx = NULL};
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char **roms = NULL;
+    int romCount = 0;
+
+    if (!parseArgs(argc, argv, &params, &threads, &roms, &romCount))
+    {
+        fprintf(stderr, "Usage: %s [--cycles <int>] [--freq <int>] [--input <file>] [--replay <file>] [--seed <int>] [--quirks <shift|none>] [--timing <flat|vip>] [--core <interpreter|threaded|jit>] [--aot <dir>] [--trace <dir>] [--threads <int>] [--list <file>] ROM...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (threads > romCount)
+        threads = romCount;
+
+    RunResult *results = calloc(romCount, sizeof(RunResult));
+    WorkQueue *queues = aligned_alloc(64, sizeof(WorkQueue) * threads);
+    Worker *workers = calloc(threads, sizeof(Worker));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+
+    if (results == NULL || queues == NULL || workers == NULL || tids == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate the batch.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Split the roms evenly between the workers, stealing balances the rest
+    for (int i = 0; i < threads; i++)
+    {
+        uint32_t begin = (uint64_t)romCount * i / threads;
+        uint32_t end = (uint64_t)romCount * (i + 1) / threads;
+
+        atomic_init(&queues[i].range, (uint64_t)end << 32 | begin);
+        workers[i] = (Worker){.id = i, .workerCount = threads, .queues = queues, .params = &params, .results = results};
+    }
+
+    for (int i = 0; i < romCount; i++)
+        results[i].rom = roms[i];
+
+    double start = now();
+
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&tids[i], NULL, workerLoop, &workers[i]) != 0)
+        {
+            fprintf(stderr, "Error: Failed to start worker %d.\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+
+    double wallTime = now() - start;
+    int failures = 0;
+
+    printf("rom\tgfx_hash\tcycles\twall_s\tstatus\n");
+
+    for (int i = 0; i < romCount; i++)
+    {
+        const char *status = !results[i].loaded ? "load_error" : results[i].diverged ? "diverged" : results[i].failed ? "halted" : "ok";
+
+        printf("%s\t%016llx\t%lu\t%.6f\t%s\n", results[i].rom, (unsigned long long)results[i].gfxHash,
+               results[i].cycles, results[i].wallTime, status);
+
+        failures += !results[i].loaded || results[i].diverged;
+    }
+
+    fprintf(stderr, "%d runs on %d threads in %.3fs\n", romCount, threads, wallTime);
+
+#ifdef CHIP8_PROFILE
+    if (params.profilePrefix != NULL && !writeProfiles(params.profilePrefix, results, romCount))
+        failures++;
+
+    for (int i = 0; i < romCount; i++)
+        free(results[i].profile);
+#endif
+
+    free(tids);
+    free(workers);
+    free(queues);
+    free(results);
+    free(params.inputs);
+    free((void *)params.expectedGfx);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+bool parseArgs(int argc, char *argv[], RunParams *params, int *threads, char ***roms, int *romCount)
+{
+    *roms = malloc(sizeof(char *) * argc);
+
+    if (*roms == NULL)
+        return false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+
+        // [--cycles <int>]
+        if (strcmp(argv[i], "--cycles") == 0)
+        {
+            if (!hasValue || (params->cycles = strtoul(argv[++i], NULL, 10)) == 0)
+            {
+                fprintf(stderr, "Error: --cycles requires a positive integer value.\n");
+                return false;
+            }
+            continue;
+        }
+
+        // [--freq <int>]
+        if (strcmp(argv[i], "--freq") == 0)
+        {
+            if (!hasValue || (params->processorFreq = atoi(argv[++i])) <= 0)
+            {
+                fprintf(stderr, "Error: --freq requires a positive integer value.\n");
+                return false;
+            }
+            continue;
+        }
+
+        // [--threads <int>]
+        if (strcmp(argv[i], "--threads") == 0)
+        {
+            if (!hasValue || (*threads = atoi(argv[++i])) <= 0)
+            {
+                fprintf(stderr, "Error: --threads requires a positive integer value.\n");
+                return false;
+            }
+            continue;
+        }
+
+        // [--quirks <shift|none>]
+        if (strcmp(argv[i], "--quirks") == 0)
+        {
+            if (!hasValue || (strcmp(argv[i + 1], "shift") != 0 && strcmp(argv[i + 1], "none") != 0))
+            {
+                fprintf(stderr, "Error: --quirks requires 'shift' or 'none'.\n");
+                return false;
+            }
+            params->shiftQuirk = strcmp(argv[++i], "shift") == 0;
+            continue;
+        }
+
+        // [--timing <flat|vip>]
+        if (strcmp(argv[i], "--timing") == 0)
+        {
+            if (!hasValue || (strcmp(argv[i + 1], "flat") != 0 && strcmp(argv[i + 1], "vip") != 0))
+            {
+                fprintf(stderr, "Error: --timing requires 'flat' or 'vip'.\n");
+                return false;
+            }
+            params->costModel = strcmp(argv[++i], "vip") == 0 ? CHIP8_COST_VIP : CHIP8_COST_FLAT;
+            continue;
+        }
+
+        // [--core <interpreter|threaded|jit>]
+        if (strcmp(argv[i], "--core") == 0)
+        {
+            if (!hasValue || (strcmp(argv[i + 1], "interpreter") != 0 && strcmp(argv[i + 1], "threaded") != 0 && strcmp(argv[i + 1], "jit") != 0))
+            {
+                fprintf(stderr, "Error: --core requires 'interpreter', 'threaded' or 'jit'.\n");
+                return false;
+            }
+            params->jit = strcmp(argv[i + 1], "jit") == 0;
+            params->core = strcmp(argv[++i], "threaded") == 0 ? CHIP8_CORE_THREADED : CHIP8_CORE_INTERPRETER;
+            continue;
+        }
+
+        // [--aot <dir>]
+        if (strcmp(argv[i], "--aot") == 0)
+        {
+            if (!hasValue)
+            {
+                fprintf(stderr, "Error: --aot requires the directory with the compiled roms.\n");
+                return false;
+            }
+            params->aotDir = argv[++i];
+            continue;
+        }
+
+        // [--trace <dir>]
+        if (strcmp(argv[i], "--trace") == 0)
+        {
+            if (!hasValue)
+            {
+                fprintf(stderr, "Error: --trace requires the directory to write the traces of the failed runs to.\n");
+                return false;
+            }
+            params->traceDir = argv[++i];
+            continue;
+        }
+
+        // [--input <file>]
+        if (strcmp(argv[i], "--input") == 0)
+        {
+            if (!hasValue || !readInputScript(argv[++i], params))
+            {
+                fprintf(stderr, "Error: --input requires a readable input script.\n");
+                return false;
+            }
+            continue;
+        }
+
+        // [--replay <file>]
+        if (strcmp(argv[i], "--replay") == 0)
+        {
+            if (!hasValue || !readInputLog(argv[++i], params))
+            {
+                fprintf(stderr, "Error: --replay requires an input log recorded by chip8 --record.\n");
+                return false;
+            }
+            continue;
+        }
+
+        // [--seed <int>]
+        if (strcmp(argv[i], "--seed") == 0)
+        {
+            char *endptr;
+
+            if (!hasValue || (params->seed = strtoull(argv[i + 1], &endptr, 0), *endptr != '\0' || endptr == argv[i + 1]))
+            {
+                fprintf(stderr, "Error: --seed requires an unsigned integer value.\n");
+                return false;
+            }
+            i++;
+            continue;
+        }
+
+#ifdef CHIP8_PROFILE
+        // [--profile <prefix>]
+        if (strcmp(argv[i], "--profile") == 0)
+        {
+            if (!hasValue)
+            {
+                fprintf(stderr, "Error: --profile requires the prefix of the files to write the profiles to.\n");
+                return false;
+            }
+            params->profilePrefix = argv[++i];
+            continue;
+        }
+
+#endif
+        // [--list <file>]
+        if (strcmp(argv[i], "--list") == 0)
+        {
+            if (!hasValue || !readRomList(argv[++i], roms, romCount))
+            {
+                fprintf(stderr, "Error: --list requires a readable file with one rom per line.\n");
+                return false;
+            }
+            continue;
+        }
+
+        (*roms)[(*romCount)++] = argv[i];
+    }
+
+    return *romCount > 0;
+}
+
+bool readRomList(const char *file, char ***roms, int *romCount)
+{
+    FILE *fp = fopen(file, "r");
+    char line[4096];
+    int capacity = *romCount + 64;
+
+    if (fp == NULL)
+        return false;
+
+    *roms = realloc(*roms, sizeof(char *) * capacity);
+
+    while (*roms != NULL && fgets(line, sizeof(line), fp) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        if (*romCount == capacity)
+        {
+            capacity *= 2;
+            *roms = realloc(*roms, sizeof(char *) * capacity);
+
+            if (*roms == NULL)
+                break;
+        }
+
+        (*roms)[(*romCount)++] = strdup(line);
+    }
+
+    fclose(fp);
+
+    return *roms != NULL;
+}
+
+/*
+ * Read the key transitions of an input script. Each line follows the format
+ * "<cycle> <key> <down|up>", with the key as a hex digit from 0 to F.
+ * Lines starting with '#' are ignored. Events must be sorted by cycle.
+ */
+bool readInputScript(const char *file, RunParams *params)
+{
+    FILE *fp = fopen(file, "r");
+    char line[256];
+    char state[8];
+    unsigned long cycle;
+    unsigned int key;
+
+    if (fp == NULL)
+        return false;
+
+    params->inputs = malloc(sizeof(InputEvent) * MAX_INPUT_EVENTS);
+    params->inputCount = 0;
+
+    while (params->inputs != NULL && fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (params->inputCount == MAX_INPUT_EVENTS)
+        {
+            fprintf(stderr, "The input script '%s' has more than %d key transitions.\n", file, MAX_INPUT_EVENTS);
+            fclose(fp);
+            return false;
+        }
+
+        if (sscanf(line, "%lu %x %7s", &cycle, &key, state) != 3 || key > 0xF ||
+            (strcmp(state, "down") != 0 && strcmp(state, "up") != 0) ||
+            (params->inputCount > 0 && cycle < params->inputs[params->inputCount - 1].cycle))
+        {
+            fprintf(stderr, "Invalid input script line: %s", line);
+            fclose(fp);
+            return false;
+        }
+
+        params->inputs[params->inputCount++] = (InputEvent){.cycle = cycle, .key = key, .pressed = strcmp(state, "down") == 0};
+    }
+
+    fclose(fp);
+
+    return params->inputs != NULL;
+}
+
+/*
+ * Take the whole session from an input log: how the Chip8 was set up, its length, each
+ * key transition and the display it must end with. Replaces any input script.
+ */
+bool readInputLog(const char *file, RunParams *params)
+{
+    Chip8InputLog log;
+    uint16_t keys = 0;
+
+    if (!input_load(&log, file))
+        return false;
+
+    free(params->inputs);
+    free((void *)params->expectedGfx);
+
+    uint64_t *expectedGfx = malloc(sizeof(log.gfx));
+    params->inputs = malloc(sizeof(InputEvent) * MAX_INPUT_EVENTS);
+    params->inputCount = 0;
+    params->expectedGfx = expectedGfx;
+
+    if (params->inputs == NULL || expectedGfx == NULL)
+    {
+        input_free(&log);
+        return false;
+    }
+
+    memcpy(expectedGfx, log.gfx, sizeof(log.gfx));
+    params->processorFreq = log.processorFreq;
+    params->costModel = log.costModel;
+    params->shiftQuirk = log.shiftQuirk;
+    params->seed = log.seed;
+    params->cycles = log.cycles;
+
+    // Each change of the keypad becomes a transition of every key it changed
+    for (unsigned int i = 0; i < log.count; i++)
+    {
+        for (int key = 0; key < 16; key++)
+        {
+            if (((log.events[i].keys ^ keys) >> key & 1) == 0)
+                continue;
+
+            if (params->inputCount == MAX_INPUT_EVENTS)
+            {
+                fprintf(stderr, "The input log '%s' has more than %d key transitions.\n", file, MAX_INPUT_EVENTS);
+                input_free(&log);
+                return false;
+            }
+
+            params->inputs[params->inputCount++] = (InputEvent){.cycle = log.events[i].cycle, .key = key, .pressed = log.events[i].keys >> key & 1};
+        }
+
+        keys = log.events[i].keys;
+    }
+
+    input_free(&log);
+
+    return true;
+}
+
+#ifdef CHIP8_PROFILE
+/*
+ * Write the profile of each loaded rom to <prefix>.json, as an array in the order of the
+ * roms, and to <prefix>.folded, as stacks rooted at the rom for flame graph tools.
+ */
+bool writeProfiles(const char *prefix, const RunResult *results, int romCount)
+{
+    char jsonPath[4096];
+    char foldedPath[4096];
+
+    snprintf(jsonPath, sizeof(jsonPath), "%s.json", prefix);
+    snprintf(foldedPath, sizeof(foldedPath), "%s.folded", prefix);
+
+    FILE *json = fopen(jsonPath, "w");
+    FILE *folded = fopen(foldedPath, "w");
+    bool first = true;
+
+    if (json == NULL || folded == NULL)
+    {
+        fprintf(stderr, "Error: Failed to open '%s' or '%s' for writing.\n", jsonPath, foldedPath);
+
+        if (json != NULL)
+            fclose(json);
+
+        if (folded != NULL)
+            fclose(folded);
+
+        return false;
+    }
+
+    fprintf(json, "[");
+
+    for (int i = 0; i < romCount; i++)
+    {
+        if (results[i].profile == NULL)
+            continue;
+
+        fprintf(json, first ? "\n" : ",\n");
+        chip8_profileJson(results[i].profile, results[i].rom, json);
+        chip8_profileFolded(results[i].profile, results[i].rom, folded);
+        first = false;
+    }
+
+    fprintf(json, "\n]\n");
+
+    // Errors are sticky, so a single check per file covers every write
+    bool failed = ferror(json) != 0 || ferror(folded) != 0;
+
+    failed |= fclose(json) != 0;
+    failed |= fclose(folded) != 0;
+
+    if (failed)
+    {
+        fprintf(stderr, "Error: Failed to write the profiles to '%s' and '%s'.\n", jsonPath, foldedPath);
+        return false;
+    }
+
+    return true;
+}
+#endif
@@ -0,0 +1,572 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+
+#include "../include/chip8.h"
+#include "../include/jit.h"
+#include "../include/lockstep.h"
+#include "../include/renderer.h"
+
+#define MAX_REPEATS 100
+#define MAX_RESULTS 256
+
+// Processor frequency of every run, which only sets how many instructions make a 60Hz frame
+#define PROCESSOR_FREQ 700
+
+// Presents timed per repetition of the gfx_draw benchmark
+#define GFX_DRAWS 2000
+
+// Machines run side by side by the lockstep core, splitting the instructions of a repetition between them
+#define LOCKSTEP_LANES 256
+
+// Loop of ALU instructions, skips and a jump, all of them dispatched and none leaving the core
+static const unsigned char DISPATCH_PROGRAM[] = {
+    0x60, 0x01, // 200: LD V0, 1
+    0x61, 0x02, // 202: LD V1, 2
+    0x80, 0x14, // 204: ADD V0, V1
+    0x81, 0x05, // 206: SUB V1, V0
+    0x80, 0x12, // 208: AND V0, V1
+    0x80, 0x13, // 20A: XOR V0, V1
+    0x70, 0x03, // 20C: ADD V0, 3
+    0x81, 0x06, // 20E: SHR V1
+    0x30, 0x00, // 210: SE V0, 0
+    0x12, 0x04, // 212: JP 204
+};
+
+// Sprites drawn all over the display, wrapping around it, each draw handing control back to the host
+static const unsigned char SPRITE_PROGRAM[] = {
+    0xA0, 0x00, // 200: LD I, 0 (the font sprite of 0)
+    0xD0, 0x15, // 202: DRW V0, V1, 5
+    0x70, 0x03, // 204: ADD V0, 3
+    0x71, 0x01, // 206: ADD V1, 1
+    0x12, 0x02, // 208: JP 202
+};
+
+// BCD and register dumps and loads, away from the code
+static const unsigned char BCD_PROGRAM[] = {
+    0xA8, 0x00, // 200: LD I, 800
+    0xF0, 0x33, // 202: LD B, V0
+    0xF2, 0x65, // 204: LD V2, [I]
+    0x73, 0x01, // 206: ADD V3, 1
+    0xF3, 0x55, // 208: LD [I], V3
+    0x80, 0x30, // 20A: LD V0, V3
+    0x12, 0x02, // 20C: JP 202
+};
+
+// Ways of running the instructions, as selected by --core
+typedef enum
+{
+    BENCH_INTERPRETER,
+    BENCH_THREADED,
+    BENCH_JIT,
+    BENCH_LOCKSTEP, // LOCKSTEP_LANES machines at once, each with its own seed, see lockstep.h
+    BENCH_CORE_COUNT
+} BenchCore;
+
+static const char *CORE_NAMES[BENCH_CORE_COUNT] = {"interpreter", "threaded", "jit", "lockstep"};
+
+// Timings of a benchmark over every repetition
+typedef struct
+{
+    char name[256];
+    const char *core; // NULL for the benchmarks that don't run instructions
+    unsigned long operations; // Instructions or draws per repetition
+    double frames;            // 60Hz frames emulated per repetition. 0 when it isn't emulating
+    double seconds[MAX_REPEATS];
+    int repeats;
+} BenchResult;
+
+// Summary of the repetitions of a benchmark, in nanoseconds per operation
+typedef struct
+{
+    double median;
+    double min;
+    double mean;
+    double stddev;
+} BenchStats;
+
+typedef struct
+{
+    int repeats;
+    unsigned long cycles; // Instructions run by each repetition of the instruction benchmarks
+    bool cores[BENCH_CORE_COUNT];
+    bool gfx;
+    bool json;
+    char **roms;
+    int romCount;
+} BenchParams;
+
+bool parseArgs(int argc, char *argv[], BenchParams *params);
+double now();
+
+// Load the given program at 0x200 of a fresh Chip8 and run the given amount of instructions on the given core
+bool benchProgram(BenchResult *result, const BenchParams *params, BenchCore core, const char *name, const unsigned char *program, size_t size);
+bool benchRom(BenchResult *result, const BenchParams *params, BenchCore core, const char *rom);
+bool benchLockstep(BenchResult *result, const BenchParams *params, const Chip8 *initial);
+bool benchDrawSprite(BenchResult *result, const BenchParams *params);
+bool benchGfxDraw(BenchResult *result, const BenchParams *params);
+
+BenchStats summarize(const BenchResult *result);
+void printTable(const BenchResult *results, int count);
+void printJson(const BenchResult *results, int count, const BenchParams *params);
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchParams params = {.repeats = 5, .cycles = 10000000, .cores = {true, true, true, true}, .gfx = true, .json = false};
+    static BenchResult results[MAX_RESULTS];
+    int count = 0;
+
+    if (!parseArgs(argc, argv, &params))
+    {
+        fprintf(stderr, "Usage: %s [--repeat <int>] [--cycles <int>] [--core <interpreter|threaded|jit|lockstep|all>] [--no-gfx] [--json] [ROM...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int core = 0; core < BENCH_CORE_COUNT; core++)
+    {
+        if (!params.cores[core])
+            continue;
+
+        if (benchProgram(&results[count], &params, core, "dispatch", DISPATCH_PROGRAM, sizeof(DISPATCH_PROGRAM)))
+            count++;
+
+        if (benchProgram(&results[count], &params, core, "sprite", SPRITE_PROGRAM, sizeof(SPRITE_PROGRAM)))
+            count++;
+
+        if (benchProgram(&results[count], &params, core, "bcd", BCD_PROGRAM, sizeof(BCD_PROGRAM)))
+            count++;
+    }
+
+    if (benchDrawSprite(&results[count], &params))
+        count++;
+
+    if (params.gfx && benchGfxDraw(&results[count], &params))
+        count++;
+
+    // Real roms, as the runners would run them headlessly
+    for (int i = 0; i < params.romCount; i++)
+    {
+        for (int core = 0; core < BENCH_CORE_COUNT && count < MAX_RESULTS; core++)
+        {
+            if (params.cores[core] && benchRom(&results[count], &params, core, params.roms[i]))
+                count++;
+        }
+    }
+
+    if (params.json)
+        printJson(results, count, &params);
+    else
+        printTable(results, count);
+
+    free(params.roms);
+
+    return EXIT_SUCCESS;
+}
+
+// Run the instructions of a repetition. Return the seconds it took, or a negative value when the machine halted
+double runCycles(Chip8 *chip8, Chip8Jit *jit, unsigned long cycles)
+{
+    double start = now();
+
+    while (chip8->cycles < cycles)
+    {
+        // Only maxCycles bounds the slices, like in chip8-batch
+        chip8->budget = LONG_MAX;
+
+        unsigned int slice = cycles - chip8->cycles < UINT_MAX ? cycles - chip8->cycles : UINT_MAX;
+        Chip8StopReason reason = jit != NULL ? jit_runFor(jit, 0, slice) : chip8_runFor(chip8, 0, slice);
+
+        if (reason == CHIP8_STOP_ERROR)
+            return -1;
+    }
+
+    return now() - start;
+}
+
+// Time every repetition, after an untimed one to warm up the caches and the JIT translations
+bool benchChip8(BenchResult *result, const BenchParams *params, BenchCore core, const Chip8 *initial)
+{
+    static Chip8 chip8;
+    Chip8Jit *jit = NULL;
+
+    if (core == BENCH_LOCKSTEP)
+        return benchLockstep(result, params, initial);
+
+    result->core = CORE_NAMES[core];
+    result->operations = params->cycles;
+    result->repeats = 0;
+
+    for (int i = -1; i < params->repeats; i++)
+    {
+        memcpy(&chip8, initial, sizeof(chip8));
+        chip8.core = core == BENCH_THREADED ? CHIP8_CORE_THREADED : CHIP8_CORE_INTERPRETER;
+
+        if (core == BENCH_JIT && jit == NULL && (jit = jit_create(&chip8)) == NULL)
+        {
+            fprintf(stderr, "The JIT isn't available on this host, skipping %s on it.\n", result->name);
+            return false;
+        }
+
+        // Translations stay valid, as the program starts over from the same memory
+        double seconds = runCycles(&chip8, jit, params->cycles);
+
+        if (seconds < 0)
+        {
+            fprintf(stderr, "%s halted on the %s core, skipping it.\n", result->name, result->core);
+
+            if (jit != NULL)
+                jit_destroy(jit);
+
+            return false;
+        }
+
+        if (i >= 0)
+            result->seconds[result->repeats++] = seconds;
+    }
+
+    result->frames = chip8.timerPeriod > 0 ? (double)chip8.clock / chip8.timerPeriod : 0;
+
+    if (jit != NULL)
+        jit_destroy(jit);
+
+    return true;
+}
+
+// Same as benchChip8(), the instructions of a repetition being split between all the lanes
+bool benchLockstep(BenchResult *result, const BenchParams *params, const Chip8 *initial)
+{
+    unsigned long steps = params->cycles / LOCKSTEP_LANES > 0 ? params->cycles / LOCKSTEP_LANES : 1;
+
+    result->core = CORE_NAMES[BENCH_LOCKSTEP];
+    result->operations = steps * LOCKSTEP_LANES;
+    result->frames = (double)steps * CHIP8_FLAT_COST / initial->timerPeriod * LOCKSTEP_LANES;
+    result->repeats = 0;
+
+    for (int i = -1; i < params->repeats; i++)
+    {
+        Chip8Lockstep *lockstep = lockstep_create(initial, LOCKSTEP_LANES);
+
+        if (lockstep == NULL)
+            return false;
+
+        // Lanes draw different numbers, so programs relying on them diverge
+        for (unsigned int lane = 0; lane < LOCKSTEP_LANES; lane++)
+            lockstep_seed(lockstep, lane, lane + 1);
+
+        double start = now();
+        unsigned int running = lockstep_run(lockstep, steps);
+        double seconds = now() - start;
+
+        lockstep_destroy(lockstep);
+
+        if (running < LOCKSTEP_LANES)
+        {
+            fprintf(stderr, "%s halted on the %s core, skipping it.\n", result->name, result->core);
+            return false;
+        }
+
+        if (i >= 0)
+            result->seconds[result->repeats++] = seconds;
+    }
+
+    return true;
+}
+
+
+bool benchProgram(BenchResult *result, const BenchParams *params, BenchCore core, const char *name, const unsigned char *program, size_t size)
+{
+    static Chip8 initial;
+
+    chip8_init(&initial, PROCESSOR_FREQ);
+    memcpy(initial.memory + 512, program, size);
+    chip8_invalidateCode(&initial, 512, size);
+
+    snprintf(result->name, sizeof(result->name), "%s", name);
+
+    return benchChip8(result, params, core, &initial);
+}
+
+bool benchRom(BenchResult *result, const BenchParams *params, BenchCore core, const char *rom)
+{
+    static Chip8 initial;
+
+    chip8_init(&initial, PROCESSOR_FREQ);
+
+    if (!chip8_loadGame(&initial, (char *)rom))
+        return false;
+
+    snprintf(result->name, sizeof(result->name), "%s", rom);
+
+    return benchChip8(result, params, core, &initial);
+}
+
+bool benchDrawSprite(BenchResult *result, const BenchParams *params)
+{
+    static Chip8 chip8;
+    volatile bool collision = false; // Keeps the draws from being optimized away
+
+    chip8_init(&chip8, PROCESSOR_FREQ);
+
+    snprintf(result->name, sizeof(result->name), "chip8_drawSprite");
+    result->core = NULL;
+    result->operations = params->cycles;
+    result->frames = 0;
+    result->repeats = 0;
+
+    // Every 8 by 15 sprite position, wrapping around both edges
+    for (int i = -1; i < params->repeats; i++)
+    {
+        double start = now();
+
+        for (unsigned long draw = 0; draw < params->cycles; draw++)
+            collision = chip8_drawSprite(&chip8, draw % CHIP8_GFX_W, draw / CHIP8_GFX_W % CHIP8_GFX_H, 15, 0);
+
+        if (i >= 0)
+            result->seconds[result->repeats++] = now() - start;
+    }
+
+    (void)collision;
+
+    return true;
+}
+
+bool benchGfxDraw(BenchResult *result, const BenchParams *params)
+{
+    unsigned char bg[3] = {0, 0, 0};
+    unsigned char fg[3] = {255, 255, 255};
+    uint64_t gfx[CHIP8_GFX_H];
+
+    // Headless unless told otherwise, so the renderer is measured rather than the display
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+
+    if (!gfx_init(CHIP8_GFX_W, CHIP8_GFX_H, bg, fg))
+    {
+        fprintf(stderr, "The renderer couldn't be initialized, skipping gfx_draw.\n");
+        return false;
+    }
+
+    snprintf(result->name, sizeof(result->name), "gfx_draw");
+    result->core = NULL;
+    result->operations = GFX_DRAWS;
+    result->frames = GFX_DRAWS;
+    result->repeats = 0;
+
+    for (int i = -1; i < params->repeats; i++)
+    {
+        double start = now();
+
+        // A different display each time, like a running program
+        for (int draw = 0; draw < GFX_DRAWS; draw++)
+        {
+            for (int row = 0; row < CHIP8_GFX_H; row++)
+                gfx[row] = 0x9E3779B97F4A7C15ULL * (draw + row);
+
+            gfx_draw(gfx);
+        }
+
+        if (i >= 0)
+            result->seconds[result->repeats++] = now() - start;
+    }
+
+    gfx_destroy();
+
+    return true;
+}
+
+int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+BenchStats summarize(const BenchResult *result)
+{
+    double ns[MAX_REPEATS];
+    double sum = 0;
+    double squares = 0;
+    BenchStats stats;
+
+    for (int i = 0; i < result->repeats; i++)
+    {
+        ns[i] = result->seconds[i] * 1e9 / result->operations;
+        sum += ns[i];
+    }
+
+    qsort(ns, result->repeats, sizeof(double), compareDoubles);
+
+    stats.median = result->repeats % 2 ? ns[result->repeats / 2] : (ns[result->repeats / 2 - 1] + ns[result->repeats / 2]) / 2;
+    stats.min = ns[0];
+    stats.mean = sum / result->repeats;
+
+    for (int i = 0; i < result->repeats; i++)
+        squares += (ns[i] - stats.mean) * (ns[i] - stats.mean);
+
+    stats.stddev = result->repeats > 1 ? sqrt(squares / (result->repeats - 1)) : 0;
+
+    return stats;
+}
+
+void printTable(const BenchResult *results, int count)
+{
+    printf("%-24s %-12s %12s %12s %10s %10s %12s\n", "benchmark", "core", "ns/op", "min ns/op", "stddev", "MIPS", "frames/s");
+
+    for (int i = 0; i < count; i++)
+    {
+        BenchStats stats = summarize(&results[i]);
+        double seconds = stats.median * results[i].operations / 1e9;
+
+        char mips[32] = "-";
+        char frames[32] = "-";
+
+        // Neither applies to every benchmark
+        if (results[i].core != NULL)
+            snprintf(mips, sizeof(mips), "%.2f", 1e3 / stats.median);
+
+        if (results[i].frames > 0)
+            snprintf(frames, sizeof(frames), "%.1f", results[i].frames / seconds);
+
+        printf("%-24s %-12s %12.3f %12.3f %10.3f %10s %12s\n", results[i].name, results[i].core != NULL ? results[i].core : "-",
+               stats.median, stats.min, stats.stddev, mips, frames);
+    }
+}
+
+// Print the given string as a JSON string, escaping what has to be
+void printJsonString(const char *str)
+{
+    putchar('"');
+
+    for (; *str != '\0'; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            printf("\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            printf("\\u%04x", *str);
+        else
+            putchar(*str);
+    }
+
+    putchar('"');
+}
+
+void printJson(const BenchResult *results, int count, const BenchParams *params)
+{
+    printf("{\"repeats\": %d, \"cycles\": %lu, \"results\": [", params->repeats, params->cycles);
+
+    for (int i = 0; i < count; i++)
+    {
+        BenchStats stats = summarize(&results[i]);
+        double seconds = stats.median * results[i].operations / 1e9;
+
+        printf("%s\n  {\"name\": ", i > 0 ? "," : "");
+        printJsonString(results[i].name);
+        printf(", \"core\": ");
+
+        if (results[i].core != NULL)
+            printJsonString(results[i].core);
+        else
+            printf("null");
+
+        printf(", \"operations\": %lu, \"ns_per_op\": {\"median\": %.4f, \"min\": %.4f, \"mean\": %.4f, \"stddev\": %.4f}",
+               results[i].operations, stats.median, stats.min, stats.mean, stats.stddev);
+        if (results[i].core != NULL)
+            printf(", \"mips\": %.4f", 1e3 / stats.median);
+        else
+            printf(", \"mips\": null");
+
+        if (results[i].frames > 0)
+            printf(", \"frames_per_sec\": %.2f}", results[i].frames / seconds);
+        else
+            printf(", \"frames_per_sec\": null}");
+    }
+
+    printf("\n]}\n");
+}
+
+bool parseArgs(int argc, char *argv[], BenchParams *params)
+{
+    params->roms = malloc(sizeof(char *) * argc);
+    params->romCount = 0;
+
+    if (params->roms == NULL)
+        return false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+
+        // [--repeat <int>]
+        if (strcmp(argv[i], "--repeat") == 0)
+        {
+            if (!hasValue || (params->repeats = atoi(argv[++i])) <= 0 || params->repeats > MAX_REPEATS)
+            {
+                fprintf(stderr, "Error: --repeat requires an integer value from 1 to %d.\n", MAX_REPEATS);
+                return false;
+            }
+            continue;
+        }
+
+        // [--cycles <int>]
+        if (strcmp(argv[i], "--cycles") == 0)
+        {
+            if (!hasValue || (params->cycles = strtoul(argv[++i], NULL, 10)) == 0)
+            {
+                fprintf(stderr, "Error: --cycles requires a positive integer value.\n");
+                return false;
+            }
+            continue;
+        }
+
+        // [--core <interpreter|threaded|jit|lockstep|all>]
+        if (strcmp(argv[i], "--core") == 0)
+        {
+            int core = 0;
+
+            while (hasValue && core < BENCH_CORE_COUNT && strcmp(argv[i + 1], CORE_NAMES[core]) != 0)
+                core++;
+
+            if (!hasValue || (core == BENCH_CORE_COUNT && strcmp(argv[i + 1], "all") != 0))
+            {
+                fprintf(stderr, "Error: --core requires 'interpreter', 'threaded', 'jit', 'lockstep' or 'all'.\n");
+                return false;
+            }
+
+            for (int j = 0; j < BENCH_CORE_COUNT; j++)
+                params->cores[j] = core == BENCH_CORE_COUNT || j == core;
+
+            i++;
+            continue;
+        }
+
+        // [--no-gfx]
+        if (strcmp(argv[i], "--no-gfx") == 0)
+        {
+            params->gfx = false;
+            continue;
+        }
+
+        // [--json]
+        if (strcmp(argv[i], "--json") == 0)
+        {
+            params->json = true;
+            continue;
+        }
+
+        params->roms[params->romCount++] = argv[i];
+    }
+
+    return true;
+}
@@ -1,27 +1,26 @@
 #include "../include/chip8.h"
+#include "../include/trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <stddef.h>
 
-#define PROGRAM_SECTION 512
-
-// 60Hz
-#define TIMER_REGISTERS_TIMESTEP 1.0 / 60.0
-
-// 700Hz by default
-double processor_timestep = 1.0 / 700.0;
-
-// Time passed since latest cycle for dt and st
-double tTimerRegistersFrequency = 0;
+#ifdef CHIP8_PROFILE
+#    if defined(__x86_64__) || defined(__i386__)
+#        include <x86intrin.h>
+#    else
+#        include <time.h>
+#    endif
+#endif
 
-// Time passed since the latest instruction execution
-double tProcessorFrequency = 0;
+#define PROGRAM_SECTION 512
 
 // Predefined sprites (5 bytes long each), from 0 to F
-const char SPRITES[] = {
+static const char SPRITES[] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
     0x20, 0x60, 0x20, 0x20, 0x70, // 1
     0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
@@ -40,18 +39,61 @@ const char SPRITES[] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80, // F
 };
 
-/*
- * Store the addresses for all the functions used to decode an opCode.
- * For the sake of organization, there are 16 (0x0 to 0xF) distinct functions.
- * Each function has the logic for all possible opCodes that start with a
- * specific nibble.
- * E.g.: nibE() (decodeByHighestNibble[14]) decodes all opCodes starting with
- * 'E' (like E19E or EFA1).
- */
-bool (*decodeByHighestNibble[16])(unsigned short, Chip8 *);
+// Handlers, one for each instruction, indexed by Chip8DecodedOp.op
+enum
+{
+    OP_UNDECODED, // Cache entry to be filled on the next fetch
+    OP_INVALID,
+    OP_00E0, OP_00EE, OP_1nnn, OP_2nnn, OP_3xkk, OP_4xkk, OP_5xy0, OP_6xkk, OP_7xkk,
+    OP_8xy0, OP_8xy1, OP_8xy2, OP_8xy3, OP_8xy4, OP_8xy5, OP_8xy6, OP_8xy7, OP_8xyE,
+    OP_9xy0, OP_Annn, OP_Bnnn, OP_Cxkk, OP_Dxyn, OP_Ex9E, OP_ExA1,
+    OP_Fx07, OP_Fx0A, OP_Fx15, OP_Fx18, OP_Fx1E, OP_Fx29, OP_Fx33, OP_Fx55, OP_Fx65,
+    OP_COUNT
+};
+
+typedef bool (*OpHandler)(Chip8 *c, const Chip8DecodedOp *op);
+
+#ifdef CHIP8_PROFILE
+_Static_assert(OP_COUNT <= CHIP8_PROFILE_HANDLERS, "Chip8Profile needs a counter per handler");
+
+// Handlers as named in their comments, for the profile
+static const char *const OP_NAMES[OP_COUNT] = {
+    "undecoded", "invalid",
+    "00E0", "00EE", "1nnn", "2nnn", "3xkk", "4xkk", "5xy0", "6xkk", "7xkk",
+    "8xy0", "8xy1", "8xy2", "8xy3", "8xy4", "8xy5", "8xy6", "8xy7", "8xyE",
+    "9xy0", "Annn", "Bnnn", "Cxkk", "Dxyn", "Ex9E", "ExA1",
+    "Fx07", "Fx0A", "Fx15", "Fx18", "Fx1E", "Fx29", "Fx33", "Fx55", "Fx65",
+};
 
-// Define whether the PC should advance to the next operation after execution
-bool increasePC = true;
+static inline unsigned long long chip8_profileTicks(void)
+{
+#    if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#    else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#    endif
+}
+
+// Account for an instruction of the given handler that ran at pc for the given ticks
+static inline void chip8_profileInstruction(Chip8Profile *profile, unsigned char handler, unsigned short pc, unsigned long long ticks)
+{
+    profile->executed[handler]++;
+    profile->ticks[handler] += ticks;
+    profile->pcExecuted[pc]++;
+    profile->pcTicks[pc] += ticks;
+    profile->pcHandler[pc] = handler;
+}
+#endif
+
+static const OpHandler opHandlers[OP_COUNT];
+
+static Chip8StopReason chip8_runThreaded(Chip8 *c, unsigned int maxCycles, bool sounding);
+
+// Memory addresses wrap around the 4KB of memory
+#define ADDR(address) ((address) & 0x0FFF)
 
 // Copy the content of a file in the specified path to the CHIP8 memory
 bool chip8_loadGame(Chip8 *chip8, char *filePath)
@@ -59,8 +101,6 @@ bool chip8_loadGame(Chip8 *chip8, char *filePath)
     FILE *fp; // File Pointer
     int rel_address = PROGRAM_SECTION; // Section dedicated for the program
 
-    printf("Loading file '%s'\n", filePath);
-
     // Check if file exists and if user has permission to read it
     if (access(filePath, F_OK) == -1)
     {
@@ -87,124 +127,588 @@ bool chip8_loadGame(Chip8 *chip8, char *filePath)
     // Read all chars until the end of file is reached
     while (!feof(fp))
     {
+        if (rel_address >= (int)sizeof(chip8->memory))
+        {
+            fprintf(stderr, "File '%s' doesn't fit in the memory.\n", filePath);
+            fclose(fp);
+            return false;
+        }
+
         chip8->memory[rel_address] = currChar; // Copy current byte
         rel_address += sizeof(currChar);       // Move the pointer to the next free address
         currChar = fgetc(fp);
     }
 
-    printf("File loaded successfully.\n");
+    fclose(fp);
+
+    chip8_invalidateCode(chip8, PROGRAM_SECTION, rel_address - PROGRAM_SECTION);
 
     return true;
 }
 
-bool chip8_runInstruction(Chip8 *c)
+_Static_assert(sizeof(((Chip8 *)0)->memory) / CHIP8_PAGE_SIZE == 64 && CHIP8_GFX_H == 32,
+               "Chip8.dirtyPages and Chip8.dirtyRows need a bit per page and row");
+
+void chip8_invalidateCode(Chip8 *chip8, unsigned short address, unsigned short length)
+{
+    // The opCode starting one byte before the address also contains the first written byte
+    for (unsigned int i = 0; i <= length; i++)
+        chip8->decoded[ADDR(address - 1 + i)].op = OP_UNDECODED;
+
+    // Writes wrap around the end of the memory like the addresses do
+    for (unsigned int page = address / CHIP8_PAGE_SIZE; length > 0 && page <= (address + length - 1u) / CHIP8_PAGE_SIZE; page++)
+        chip8->dirtyPages |= (uint64_t)1 << (page % 64);
+}
+
+/*
+ * Extract the operands of the opCode at the given address and resolve its handler.
+ * Decoding goes by the highest nibble (4 bits, 1 hex digit) of the opCode, and then
+ * by its lowest nibble/byte for the groups that share the highest one (0, 8, E and F).
+ */
+static void chip8_decode(Chip8 *c, unsigned short address)
 {
     // Merge the next 2 bytes (size of an opCode) into a 2 bytes-long data type (short)
-    unsigned short opCode = c->memory[c->PC] << 8 | c->memory[c->PC + 1];
+    unsigned short opCode = c->memory[address] << 8 | c->memory[address + 1];
+    Chip8DecodedOp *op = &c->decoded[address];
 
-    /*
-     * Acquire the highest nibble (4 bits, 1 hex digit) by ignoring the second half (1 byte)
-     * of the opcode and discarding 4 bits from the first half (higher byte of the opcode)
-     * NXXX -> The Xs (lower nibbles) are discarded and N is saved to identify which function
-     * in decodeByHighestNibble[] to run.
-     */
-    unsigned short highestNibble = c->memory[c->PC] >> 4;
+    op->x = (opCode & 0x0F00) >> 8;
+    op->y = (opCode & 0x00F0) >> 4;
+    op->kk = opCode & 0x00FF;
+    op->nnn = opCode & 0x0FFF;
+    op->op = OP_INVALID;
 
-    if (highestNibble > 15)
+    switch (opCode >> 12)
     {
-        fprintf(stderr, "Failed to decode opCode [0x%X]", opCode);
-        return false;
+    case 0x0:
+        if (op->kk == 0xE0)
+            op->op = OP_00E0;
+        else if (op->kk == 0xEE)
+            op->op = OP_00EE;
+        break;
+
+    case 0x1: op->op = OP_1nnn; break;
+    case 0x2: op->op = OP_2nnn; break;
+    case 0x3: op->op = OP_3xkk; break;
+    case 0x4: op->op = OP_4xkk; break;
+    case 0x5: op->op = OP_5xy0; break;
+    case 0x6: op->op = OP_6xkk; break;
+    case 0x7: op->op = OP_7xkk; break;
+
+    case 0x8:
+        switch (opCode & 0x000F)
+        {
+        case 0x0: op->op = OP_8xy0; break;
+        case 0x1: op->op = OP_8xy1; break;
+        case 0x2: op->op = OP_8xy2; break;
+        case 0x3: op->op = OP_8xy3; break;
+        case 0x4: op->op = OP_8xy4; break;
+        case 0x5: op->op = OP_8xy5; break;
+        case 0x6: op->op = OP_8xy6; break;
+        case 0x7: op->op = OP_8xy7; break;
+        case 0xE: op->op = OP_8xyE; break;
+        }
+        break;
+
+    case 0x9: op->op = OP_9xy0; break;
+    case 0xA: op->op = OP_Annn; break;
+    case 0xB: op->op = OP_Bnnn; break;
+    case 0xC: op->op = OP_Cxkk; break;
+    case 0xD: op->op = OP_Dxyn; break;
+
+    case 0xE:
+        if (op->kk == 0x9E)
+            op->op = OP_Ex9E;
+        else if (op->kk == 0xA1)
+            op->op = OP_ExA1;
+        break;
+
+    case 0xF:
+        switch (op->kk)
+        {
+        case 0x07: op->op = OP_Fx07; break;
+        case 0x0A: op->op = OP_Fx0A; break;
+        case 0x15: op->op = OP_Fx15; break;
+        case 0x18: op->op = OP_Fx18; break;
+        case 0x1E: op->op = OP_Fx1E; break;
+        case 0x29: op->op = OP_Fx29; break;
+        case 0x33: op->op = OP_Fx33; break;
+        case 0x55: op->op = OP_Fx55; break;
+        case 0x65: op->op = OP_Fx65; break;
+        }
+        break;
     }
+}
+
+// Cost of an instruction under CHIP8_COST_VIP, in COSMAC VIP machine cycles
+typedef struct
+{
+    unsigned short base;
+    unsigned short skip; // Extra when the next instruction is skipped
+    unsigned short unit; // Extra per sprite row (Dxyn) or register (Fx55, Fx65)
+} VipCost;
+
+// Machine cycles the VIP interpreter spends fetching and decoding every instruction
+#define VIP_FETCH_COST 40
+
+// Approximation of the timings of the VIP interpreter, on top of VIP_FETCH_COST
+static const VipCost VIP_COSTS[OP_COUNT] = {
+    [OP_00E0] = {3078, 0, 0}, [OP_00EE] = {10, 0, 0}, [OP_1nnn] = {12, 0, 0}, [OP_2nnn] = {26, 0, 0},
+    [OP_3xkk] = {10, 4, 0},   [OP_4xkk] = {10, 4, 0}, [OP_5xy0] = {14, 4, 0}, [OP_6xkk] = {6, 0, 0},
+    [OP_7xkk] = {10, 0, 0},   [OP_8xy0] = {44, 0, 0}, [OP_8xy1] = {44, 0, 0}, [OP_8xy2] = {44, 0, 0},
+    [OP_8xy3] = {44, 0, 0},   [OP_8xy4] = {44, 0, 0}, [OP_8xy5] = {44, 0, 0}, [OP_8xy6] = {44, 0, 0},
+    [OP_8xy7] = {44, 0, 0},   [OP_8xyE] = {44, 0, 0}, [OP_9xy0] = {14, 4, 0}, [OP_Annn] = {12, 0, 0},
+    [OP_Bnnn] = {22, 0, 0},   [OP_Cxkk] = {36, 0, 0}, [OP_Dxyn] = {22, 0, 46}, [OP_Ex9E] = {14, 4, 0},
+    [OP_ExA1] = {14, 4, 0},   [OP_Fx07] = {10, 0, 0}, [OP_Fx0A] = {10, 0, 0}, [OP_Fx15] = {10, 0, 0},
+    [OP_Fx18] = {10, 0, 0},   [OP_Fx1E] = {16, 0, 0}, [OP_Fx29] = {20, 0, 0}, [OP_Fx33] = {152, 0, 0},
+    [OP_Fx55] = {14, 0, 14},  [OP_Fx65] = {14, 0, 14},
+};
+
+// Virtual cycles the decoded instruction takes, plus skipCost more when it skips the next one
+static inline unsigned int chip8_cost(Chip8CostModel model, const Chip8DecodedOp *op, unsigned int *skipCost)
+{
+    if (model == CHIP8_COST_FLAT)
+    {
+        *skipCost = 0;
+        return CHIP8_FLAT_COST;
+    }
+
+    const VipCost *cost = &VIP_COSTS[op->op];
+    unsigned int units = op->op == OP_Dxyn ? (op->kk & 0x0F) : op->x + 1u;
+
+    *skipCost = cost->skip;
+    return VIP_FETCH_COST + cost->base + cost->unit * units;
+}
+
+static bool chip8_runInstruction(Chip8 *c)
+{
+    // Decode the opCode only the first time it's fetched from this address
+    if (c->decoded[c->PC].op == OP_UNDECODED)
+        chip8_decode(c, c->PC);
+
+    const Chip8DecodedOp *op = &c->decoded[c->PC];
 
     // The PC should advance after running an opCode, unless the operation uncheck this
-    increasePC = true;
+    c->increasePC = true;
 
     c->drawFlag = false;
 
-    // Run the appropriate function based on the highestNibble
-    bool success = (*decodeByHighestNibble[highestNibble])(opCode, c);
+    // The handler might overwrite its own decoded entry, or jump
+    unsigned short pc = c->PC;
+
+    CHIP8_PROFILED(unsigned char handler = op->op; unsigned long long start = chip8_profileTicks();)
+
+    // Run the handler resolved for this opCode
+    bool success = (*opHandlers[op->op])(c, op);
+
+    CHIP8_PROFILED(chip8_profileInstruction(&c->profile, handler, pc, chip8_profileTicks() - start);)
+
+    if (c->trace != NULL)
+        trace_instruction(c->trace, pc, c->memory[pc] << 8 | c->memory[pc + 1], c->I, c->V);
+
+    c->cycles++;
 
     if (!success)
-        fprintf(stderr, "PC: %d | Invalid opCode: 0x%X", c->PC, opCode);
+        fprintf(stderr, "PC: %d | Invalid opCode: 0x%X", c->PC, c->memory[c->PC] << 8 | c->memory[c->PC + 1]);
 
     // Advance the pointer to the next opcode (2 bytes) if increasePC is true
-    c->PC += increasePC ? 2 : 0;
+    c->PC += c->increasePC ? 2 : 0;
 
     return success;
 }
 
-bool chip8_emulateCycle(Chip8 *chip8, double deltaTime)
+// Advance the host time passed for dt and st, decreasing them once per completed 60Hz cycle. Unrestricted frequency only
+static void chip8_updateTimers(Chip8 *chip8, double deltaTime)
 {
     // Update time passed since the lastest cycle for dt and st
-    tTimerRegistersFrequency += deltaTime;
+    chip8->tTimerRegistersFrequency += deltaTime;
 
-    if (tTimerRegistersFrequency >= TIMER_REGISTERS_TIMESTEP)
+    if (chip8->tTimerRegistersFrequency >= CHIP8_TIMERS_TIMESTEP)
     { // Cycle completed
         // Reset the time passed and keep the surplus
-        tTimerRegistersFrequency = tTimerRegistersFrequency - TIMER_REGISTERS_TIMESTEP;
+        chip8->tTimerRegistersFrequency = chip8->tTimerRegistersFrequency - CHIP8_TIMERS_TIMESTEP;
 
         // Decrease dt and st by 1 to a minimum of 0
         chip8->dt = (chip8->dt - 1 > 0) ? chip8->dt - 1 : 0;
         chip8->st = (chip8->st - 1 > 0) ? chip8->st - 1 : 0;
     }
+}
 
-    // Skip frequency verification if it's set to an invalid number
-    if (processor_timestep <= 0) {
-        return chip8_runInstruction(chip8);
+void chip8_advanceClock(Chip8 *chip8, unsigned long cycles)
+{
+    chip8->clock += cycles;
+    chip8->budget -= cycles;
+    chip8->timerCycles += cycles;
+
+    while (chip8->timerCycles >= chip8->timerPeriod)
+    {
+        chip8->timerCycles -= chip8->timerPeriod;
+
+        // Decrease dt and st by 1 to a minimum of 0
+        chip8->dt = (chip8->dt - 1 > 0) ? chip8->dt - 1 : 0;
+        chip8->st = (chip8->st - 1 > 0) ? chip8->st - 1 : 0;
     }
+}
 
-    // Update time passed since the lastest instruction execution
-    tProcessorFrequency += deltaTime;
+bool chip8_emulateCycle(Chip8 *chip8, double deltaTime)
+{
+    return chip8_runFor(chip8, deltaTime, 1) != CHIP8_STOP_ERROR;
+}
 
-    if (tProcessorFrequency >= processor_timestep)
-    { // Cycle completed
-        tProcessorFrequency = tProcessorFrequency - processor_timestep; // Reset and keep the surplus
+// Instructions a spin loop recognized by chip8_skipIdle() starts with. Fx0A is only skipped once it stopped for a key
+#define IDLE_CANDIDATE(op) ((op) == OP_Fx07 || (op) == OP_1nnn)
+
+unsigned long chip8_skipIdle(Chip8 *chip8, unsigned long limit)
+{
+    unsigned short pc = chip8->PC;
+    unsigned int skipCost;
+    unsigned long length;             // Instructions per iteration
+    unsigned long cost;               // Virtual cycles per iteration
+    unsigned long ticksLeft = ULONG_MAX; // Ticks that can happen before an iteration reads the dt ending the loop
+    unsigned long iterations;
+
+    if (pc >= sizeof(chip8->memory) - 1 || !(IDLE_CANDIDATE(chip8->decoded[pc].op) || chip8->decoded[pc].op == OP_Fx0A))
+        return 0;
+
+    const Chip8DecodedOp *op = &chip8->decoded[pc];
 
-        return chip8_runInstruction(chip8);
+    if (op->op == OP_Fx0A)
+    {
+        // Any pressed key ends the wait
+        for (int i = 0; i < 16; i++)
+        {
+            if (chip8->key[i])
+                return 0;
+        }
+
+        length = 1;
+        cost = chip8_cost(chip8->costModel, op, &skipCost);
     }
+    else if (op->op == OP_1nnn)
+    {
+        if (op->nnn != pc)
+            return 0;
 
-    return true;
+        length = 1;
+        cost = chip8_cost(chip8->costModel, op, &skipCost);
+    }
+    else
+    {
+        // Fx07 Vx, then a skip on Vx that dt keeps from happening, then a jump back, all within memory
+        unsigned short skip = pc + 2;
+        unsigned short jump = pc + 4;
+
+        if (pc >= sizeof(chip8->memory) - 5)
+            return 0;
+
+        if (chip8->decoded[skip].op == OP_UNDECODED)
+            chip8_decode(chip8, skip);
+
+        if (chip8->decoded[jump].op == OP_UNDECODED)
+            chip8_decode(chip8, jump);
+
+        const Chip8DecodedOp *test = &chip8->decoded[skip];
+        const Chip8DecodedOp *back = &chip8->decoded[jump];
+
+        if (test->x != op->x || back->op != OP_1nnn || back->nnn != pc ||
+            !((test->op == OP_3xkk && chip8->dt != test->kk) || (test->op == OP_4xkk && chip8->dt == test->kk)))
+            return 0;
+
+        // dt only goes down, to stop at 0
+        if (test->op == OP_3xkk && test->kk < chip8->dt)
+            ticksLeft = chip8->dt - test->kk - 1;
+        else if (test->op == OP_4xkk && test->kk != 0)
+            ticksLeft = 0;
+
+        length = 3;
+        cost = chip8_cost(chip8->costModel, op, &skipCost) + chip8_cost(chip8->costModel, test, &skipCost) +
+               chip8_cost(chip8->costModel, back, &skipCost);
+    }
+
+    iterations = limit / length;
+
+    /*
+     * Iteration i starts after (timerCycles + i * cost) / timerPeriod ticks. Skip the ones
+     * paid by the budget, that leave the tick stopping the sound timer to the host and
+     * whose Fx07 doesn't read the dt ending the loop.
+     */
+    if (chip8->cycleFrequency > 0)
+    {
+        unsigned long period = chip8->timerPeriod;
+        unsigned long elapsed = chip8->timerCycles;
+        unsigned long paid = chip8->budget > 0 ? (unsigned long)chip8->budget / cost : 0;
+
+        if (paid < iterations)
+            iterations = paid;
+
+        if (chip8->st > 0 && (chip8->st * period - elapsed - 1) / cost < iterations)
+            iterations = (chip8->st * period - elapsed - 1) / cost;
+
+        if (ticksLeft != ULONG_MAX && ((ticksLeft + 1) * period - elapsed - 1) / cost + 1 < iterations)
+            iterations = ((ticksLeft + 1) * period - elapsed - 1) / cost + 1;
+    }
+
+    if (iterations == 0)
+        return 0;
+
+    // What the iterations would have left behind
+    if (op->op == OP_Fx07)
+    {
+        unsigned long ticks = chip8->cycleFrequency > 0 ? (chip8->timerCycles + (iterations - 1) * cost) / chip8->timerPeriod : 0;
+
+        chip8->V[op->x] = chip8->dt > ticks ? chip8->dt - ticks : 0;
+    }
+
+    if (chip8->cycleFrequency > 0)
+        chip8_advanceClock(chip8, iterations * cost);
+
+    chip8->drawFlag = false;
+
+    CHIP8_PROFILED(*(op->op == OP_Fx0A ? &chip8->profile.keyWaitCycles : op->op == OP_1nnn ? &chip8->profile.spinCycles
+                                                                                     : &chip8->profile.timerWaitCycles) += iterations * length;)
+
+    if (chip8->trace != NULL)
+        trace_idle(chip8->trace, pc, iterations * length);
+
+    return iterations * length;
 }
 
-// 0nnn
-bool nib0(unsigned short opCode, Chip8 *c)
+// Run a single instruction and report whether the host has to be notified about it
+static Chip8StopReason chip8_step(Chip8 *chip8, bool sounding)
 {
-    switch (opCode & 0x00FF)
+    unsigned short pc = chip8->PC;
+
+    // The opCode at PC needs both of its bytes inside the memory
+    if (pc >= sizeof(chip8->memory) - 1)
     {
-    case 0x00E0: // CLS - Clear the display
-        memset(c->gfx, false, sizeof(c->gfx));
+        fprintf(stderr, "Error: PC exceeded the memory limits.");
+        return CHIP8_STOP_ERROR;
+    }
 
-        c->drawFlag = true;
-        break;
+    if (chip8->decoded[pc].op == OP_UNDECODED)
+        chip8_decode(chip8, pc);
 
-    case 0x00EE: // RET - Return from a subroutine
-        if (c->SP <= 0) {
-            fprintf(stderr, "Stack underflow\n");
-            return false;
+    // Priced before running, as the instruction might overwrite its own decoded entry
+    unsigned int skipCost;
+    unsigned int cost = chip8_cost(chip8->costModel, &chip8->decoded[pc], &skipCost);
+    bool success = chip8_runInstruction(chip8);
+
+    if (chip8->cycleFrequency > 0)
+        chip8_advanceClock(chip8, cost + (chip8->PC == pc + 4 ? skipCost : 0));
+
+    if (!success)
+        return CHIP8_STOP_ERROR;
+
+    if (chip8->drawFlag)
+        return CHIP8_STOP_DRAW;
+
+    if ((chip8->st > 0) != sounding)
+        return CHIP8_STOP_SOUND;
+
+    // Fx0A didn't find a pressed key and will run again
+    if (chip8->PC == pc && chip8->memory[pc] >> 4 == 0xF && chip8->memory[pc + 1] == 0x0A)
+        return CHIP8_STOP_KEY_WAIT;
+
+    return CHIP8_STOP_BUDGET;
+}
+
+Chip8StopReason chip8_runFor(Chip8 *chip8, double deltaTime, unsigned int maxCycles)
+{
+    Chip8StopReason reason;
+    bool sounding = chip8->st > 0;
+    bool timed = chip8->cycleFrequency > 0;
+
+    if (!timed)
+    {
+        // There's no instruction duration to place the ticks with, so account for the whole slice at once
+        chip8_updateTimers(chip8, deltaTime);
+
+        if ((chip8->st > 0) != sounding)
+            return CHIP8_STOP_SOUND;
+    }
+    else
+    {
+        // Only whole cycles go to the budget, the fraction is kept for the next slice
+        chip8->budgetFraction += deltaTime * chip8->cycleFrequency;
+
+        long granted = (long)chip8->budgetFraction;
+
+        chip8->budget += granted;
+        chip8->budgetFraction -= granted;
+    }
+
+    if (chip8->core == CHIP8_CORE_THREADED)
+        return chip8_runThreaded(chip8, maxCycles, sounding);
+
+    unsigned int cycle = 0;
+
+    while (cycle < maxCycles)
+    {
+        // Each instruction moves the virtual clock forward by its own cost once it ran
+        if (timed && chip8->budget <= 0)
+            break;
+
+        reason = chip8_step(chip8, sounding);
+        cycle++;
+
+        // Nothing changes until a key is pressed, the wait goes on up to the next tick at once
+        if (reason == CHIP8_STOP_KEY_WAIT)
+            chip8->cycles += chip8_skipIdle(chip8, maxCycles - cycle);
+
+        if (reason != CHIP8_STOP_BUDGET)
+            return reason;
+
+        // The instruction might have led into a spin loop
+        if (chip8->PC < sizeof(chip8->memory) && IDLE_CANDIDATE(chip8->decoded[chip8->PC].op))
+        {
+            unsigned long skipped = chip8_skipIdle(chip8, maxCycles - cycle);
+
+            chip8->cycles += skipped;
+            cycle += skipped;
         }
+    }
 
-        c->SP--;
-        c->PC = c->stack[c->SP];
-        break;
+    return CHIP8_STOP_BUDGET;
+}
+
+unsigned long chip8_timingWindow(const Chip8 *chip8, unsigned long limit)
+{
+    if (chip8->budget <= 0)
+        return 0;
+
+    // Instructions run while there's budget left, and the first one to reach the period ticks right after it
+    unsigned long window = chip8->budget / CHIP8_FLAT_COST + (chip8->budget % CHIP8_FLAT_COST != 0);
+    unsigned long untilTick = (chip8->timerPeriod - chip8->timerCycles + CHIP8_FLAT_COST - 1) / CHIP8_FLAT_COST;
 
-    default:
+    if (untilTick < window)
+        window = untilTick;
+
+    return window < limit ? window : limit;
+}
+
+Chip8StopReason chip8_runNative(Chip8 *c, double deltaTime, unsigned int maxCycles, Chip8NativeRun run, Chip8NativeInvalidate invalidate, void *backend)
+{
+    unsigned long start = c->cycles;
+    bool timed = c->cycleFrequency > 0;
+    Chip8StopReason reason;
+
+    // Native code is priced by its length, which only holds when every instruction costs the same, and
+    // only the interpreter records each instruction for a trace
+    if (c->costModel != CHIP8_COST_FLAT || c->trace != NULL)
+        return chip8_runFor(c, deltaTime, maxCycles);
+
+    // Account for the slice exactly like chip8_runFor() does, without running anything yet
+    reason = chip8_runFor(c, deltaTime, 0);
+
+    if (reason != CHIP8_STOP_BUDGET)
+        return reason;
+
+    while (c->cycles - start < maxCycles)
+    {
+        unsigned long limit = maxCycles - (c->cycles - start);
+        unsigned long window = timed ? chip8_timingWindow(c, limit) : limit;
+        bool sounding = c->st > 0;
+
+        if (window > 0)
+        {
+            c->drawFlag = false;
+
+            unsigned long executed = run(backend, c, window);
+
+            if (executed > 0)
+            {
+                if (timed)
+                    chip8_advanceClock(c, executed * CHIP8_FLAT_COST);
+
+                c->cycles += executed;
+                CHIP8_PROFILED(c->profile.nativeInstructions += executed;)
+
+                // Native code leaves right after the instructions the host must know about
+                if (c->drawFlag)
+                    return CHIP8_STOP_DRAW;
+
+                // dt and st tick right after the last instruction of the window
+                if ((c->st > 0) != sounding)
+                    return CHIP8_STOP_SOUND;
+
+                continue;
+            }
+        }
+
+        // Run the instruction through the interpreter, which also ticks the timers when due
+        unsigned short pc = c->PC;
+        unsigned short I = c->I;
+        unsigned long before = c->cycles;
+        bool fx33 = pc < sizeof(c->memory) - 1 && c->memory[pc] >> 4 == 0xF && c->memory[pc + 1] == 0x33;
+        bool fx55 = pc < sizeof(c->memory) - 1 && c->memory[pc] >> 4 == 0xF && c->memory[pc + 1] == 0x55;
+        unsigned short written = fx33 ? 3 : fx55 ? (c->memory[pc] & 0x0F) + 1 : 0;
+
+        reason = chip8_runFor(c, 0, 1);
+
+        // The slice ran out of time
+        if (c->cycles == before)
+            return reason;
+
+        // The write length is taken beforehand, as an Fx55 might overwrite its own opCode
+        if (written > 0)
+            invalidate(backend, ADDR(I), written);
+
+        // Go on waiting for a key up to the next tick at once, like chip8_runFor() does
+        if (reason == CHIP8_STOP_KEY_WAIT)
+            c->cycles += chip8_skipIdle(c, limit - 1);
+
+        if (reason != CHIP8_STOP_BUDGET)
+            return reason;
+    }
+
+    return CHIP8_STOP_BUDGET;
+}
+
+static bool opInvalid(Chip8 *c, const Chip8DecodedOp *op)
+{
+    (void)c;
+    (void)op;
+
+    return false;
+}
+
+// 00E0 | CLS - Clear the display
+static bool op00E0(Chip8 *c, const Chip8DecodedOp *op)
+{
+    (void)op;
+
+    memset(c->gfx, false, sizeof(c->gfx));
+    c->dirtyRows = UINT32_MAX;
+
+    c->drawFlag = true;
+    return true;
+}
+
+// 00EE | RET - Return from a subroutine
+static bool op00EE(Chip8 *c, const Chip8DecodedOp *op)
+{
+    (void)op;
+
+    if (c->SP <= 0) {
+        fprintf(stderr, "Stack underflow\n");
         return false;
     }
 
+    c->SP--;
+    c->PC = c->stack[c->SP];
     return true;
 }
 
 // 1nnn | JP addr - Jump to location nnn
-bool nib1(unsigned short opCode, Chip8 *c)
+static bool op1nnn(Chip8 *c, const Chip8DecodedOp *op)
 {
-    c->PC = opCode & 0x0FFF;
+    c->PC = op->nnn;
 
-    increasePC = false;
+    c->increasePC = false;
     return true;
 }
 
 // 2nnn | CALL addr - Call subroutine at nnn
-bool nib2(unsigned short opCode, Chip8 *c)
+static bool op2nnn(Chip8 *c, const Chip8DecodedOp *op)
 {
     if (c->SP >= 15) {
         fprintf(stderr, "Stack overflow\n");
@@ -213,280 +717,745 @@ bool nib2(unsigned short opCode, Chip8 *c)
 
     c->stack[c->SP] = c->PC;
     c->SP++;
-    c->PC = opCode & 0x0FFF;
+    c->PC = op->nnn;
 
-    increasePC = false;
+    c->increasePC = false;
     return true;
 }
 
 // 3xkk | SE Vx, byte - Skip next instruction if Vx = kk
-bool nib3(unsigned short opCode, Chip8 *c)
+static bool op3xkk(Chip8 *c, const Chip8DecodedOp *op)
 {
-    if (c->V[(opCode & 0x0F00) >> 8] == (opCode & 0x00FF))
+    if (c->V[op->x] == op->kk)
         c->PC += 2;
 
     return true;
 }
 
 // 4xkk | SNE Vx, byte - Skip next instruction if Vx != kk
-bool nib4(unsigned short opCode, Chip8 *c)
+static bool op4xkk(Chip8 *c, const Chip8DecodedOp *op)
 {
-    if (c->V[(opCode & 0x0F00) >> 8] != (opCode & 0x00FF))
+    if (c->V[op->x] != op->kk)
         c->PC += 2;
 
     return true;
 }
 
 // 5xy0 | SE Vx, Vy - Skip next instruction if Vx = Vy
-bool nib5(unsigned short opCode, Chip8 *c)
+static bool op5xy0(Chip8 *c, const Chip8DecodedOp *op)
 {
-    if (c->V[(opCode & 0x0F00) >> 8] == c->V[(opCode & 0x00F0) >> 4])
+    if (c->V[op->x] == c->V[op->y])
         c->PC += 2;
 
     return true;
 }
 
 // 6xkk | LD Vx, byte - Set Vx = kk
-bool nib6(unsigned short opCode, Chip8 *c)
+static bool op6xkk(Chip8 *c, const Chip8DecodedOp *op)
 {
-    c->V[(opCode & 0x0F00) >> 8] = opCode & 0x00FF;
+    c->V[op->x] = op->kk;
 
     return true;
 }
 
 // 7xkk | ADD Vx, byte - Set Vx = Vx + kk
-bool nib7(unsigned short opCode, Chip8 *c)
+static bool op7xkk(Chip8 *c, const Chip8DecodedOp *op)
 {
-    c->V[(opCode & 0x0F00) >> 8] += opCode & 0x00FF;
+    c->V[op->x] += op->kk;
 
     return true;
 }
 
-// 8xyn
-bool nib8(unsigned short opCode, Chip8 *c)
+// 8xy0 | LD Vx, Vy - Set Vx = Vy
+static bool op8xy0(Chip8 *c, const Chip8DecodedOp *op)
 {
-    // Every opcode from this set follows the format 8xyn
-    char Vf;
-    int x = (opCode & 0x0F00) >> 8;
-    int y = (opCode & 0x00F0) >> 4;
+    c->V[op->x] = c->V[op->y];
 
-    switch (opCode & 0x000F)
-    {
-    case 0x0000: // 8xy0 | LD Vx, Vy - Set Vx = Vy
-        c->V[x] = c->V[y];
-        break;
+    return true;
+}
 
-    case 0x0001: // 8xy1 | OR Vx, Vy - Set Vx = Vx OR Vy
-        c->V[x] |= c->V[y];
-        break;
+// 8xy1 | OR Vx, Vy - Set Vx = Vx OR Vy
+static bool op8xy1(Chip8 *c, const Chip8DecodedOp *op)
+{
+    c->V[op->x] |= c->V[op->y];
 
-    case 0x0002: // 8xy2 | AND Vx, Vy - Set Vx = Vx AND Vy
-        c->V[x] &= c->V[y];
-        break;
+    return true;
+}
 
-    case 0x0003: // 8xy3 | XOR Vx, Vy - Set Vx = Vx XOR Vy
-        c->V[x] ^= c->V[y];
-        break;
+// 8xy2 | AND Vx, Vy - Set Vx = Vx AND Vy
+static bool op8xy2(Chip8 *c, const Chip8DecodedOp *op)
+{
+    c->V[op->x] &= c->V[op->y];
 
-    case 0x0004: // 8xy4 | ADD Vx, Vy - Set Vx = Vx + Vy, set VF = carry
-        Vf = ((int)(c->V[x] + c->V[y]) > 0xFF);
-        c->V[x] = (c->V[x] + c->V[y]) & 0xFF; // Save only 1 byte from the result
-        c->V[0xF] = Vf;
-        break;
+    return true;
+}
 
-    case 0x0005: // 8xy5 | SUB Vx, Vy - Set Vx = Vx - Vy, set VF = NOT borrow
-        Vf = (c->V[x] >= c->V[y]); // No underflow
-        c->V[x] = (c->V[x] - c->V[y]) & 0xFF; // Save only 1 byte from the result
-        c->V[0xF] = Vf;
-        break;
+// 8xy3 | XOR Vx, Vy - Set Vx = Vx XOR Vy
+static bool op8xy3(Chip8 *c, const Chip8DecodedOp *op)
+{
+    c->V[op->x] ^= c->V[op->y];
 
-    case 0x0006: // 8xy6 | SHR Vx {, Vy} - Set Vx = Vx SHR 1
-        if (!c->shiftQuirk) // This quirk makes so Y is ignored for this operation
-            c->V[x] = c->V[y];
+    return true;
+}
 
-        Vf = c->V[x] % 2; // if Vx is odd, Vf = 1 | if Vx is even, Vf = 0
-        c->V[x] >>= 1; // Vx/2
-        c->V[0xF] = Vf;
-        break;
+// 8xy4 | ADD Vx, Vy - Set Vx = Vx + Vy, set VF = carry
+static bool op8xy4(Chip8 *c, const Chip8DecodedOp *op)
+{
+    char Vf = ((int)(c->V[op->x] + c->V[op->y]) > 0xFF);
+    c->V[op->x] = (c->V[op->x] + c->V[op->y]) & 0xFF; // Save only 1 byte from the result
+    c->V[0xF] = Vf;
 
-    case 0x0007: // 8xy7 | SUBN Vx, Vy - Set Vx = Vy - Vx, set VF = NOT borrow
-        Vf = (c->V[y] >= c->V[x]); // No underflow
-        c->V[x] = c->V[y] - c->V[x];
-        c->V[0xF] = Vf;
-        break;
+    return true;
+}
 
-    case 0x000E: // 8xyE | SHL Vx {, Vy} - Set Vx = Vx SHL 1
-        if (!c->shiftQuirk) // This quirk makes so Y is ignored for this operation
-            c->V[x] = c->V[y];
+// 8xy5 | SUB Vx, Vy - Set Vx = Vx - Vy, set VF = NOT borrow
+static bool op8xy5(Chip8 *c, const Chip8DecodedOp *op)
+{
+    char Vf = (c->V[op->x] >= c->V[op->y]); // No underflow
+    c->V[op->x] = (c->V[op->x] - c->V[op->y]) & 0xFF; // Save only 1 byte from the result
+    c->V[0xF] = Vf;
 
-        Vf = (c->V[x] & 128) >> 7; // 128 = (10000000)₂
-        c->V[x] <<= 1; // Vx * 2
-        c->V[0xF] = Vf;
-        break;
+    return true;
+}
 
-    default:
-        return false;
-    }
+// 8xy6 | SHR Vx {, Vy} - Set Vx = Vx SHR 1
+static bool op8xy6(Chip8 *c, const Chip8DecodedOp *op)
+{
+    if (!c->shiftQuirk) // This quirk makes so Y is ignored for this operation
+        c->V[op->x] = c->V[op->y];
+
+    char Vf = c->V[op->x] % 2; // if Vx is odd, Vf = 1 | if Vx is even, Vf = 0
+    c->V[op->x] >>= 1; // Vx/2
+    c->V[0xF] = Vf;
+
+    return true;
+}
+
+// 8xy7 | SUBN Vx, Vy - Set Vx = Vy - Vx, set VF = NOT borrow
+static bool op8xy7(Chip8 *c, const Chip8DecodedOp *op)
+{
+    char Vf = (c->V[op->y] >= c->V[op->x]); // No underflow
+    c->V[op->x] = c->V[op->y] - c->V[op->x];
+    c->V[0xF] = Vf;
+
+    return true;
+}
+
+// 8xyE | SHL Vx {, Vy} - Set Vx = Vx SHL 1
+static bool op8xyE(Chip8 *c, const Chip8DecodedOp *op)
+{
+    if (!c->shiftQuirk) // This quirk makes so Y is ignored for this operation
+        c->V[op->x] = c->V[op->y];
+
+    char Vf = (c->V[op->x] & 128) >> 7; // 128 = (10000000)₂
+    c->V[op->x] <<= 1; // Vx * 2
+    c->V[0xF] = Vf;
 
     return true;
 }
 
 // 9xy0 | SNE Vx, Vy - Skip next instruction if Vx != Vy
-bool nib9(unsigned short opCode, Chip8 *c)
+static bool op9xy0(Chip8 *c, const Chip8DecodedOp *op)
 {
-    if (c->V[(opCode & 0x0F00) >> 8] != c->V[(opCode & 0x00F0) >> 4])
+    if (c->V[op->x] != c->V[op->y])
         c->PC += 2;
 
     return true;
 }
 
 // Annn | LD I, addr - Set I = nnn
-bool nibA(unsigned short opCode, Chip8 *c)
+static bool opAnnn(Chip8 *c, const Chip8DecodedOp *op)
 {
-    c->I = opCode & 0x0FFF;
+    c->I = op->nnn;
 
     return true;
 }
 
 // Bnnn | JP V0, addr - Jump to location nnn + V0
-bool nibB(unsigned short opCode, Chip8 *c)
+static bool opBnnn(Chip8 *c, const Chip8DecodedOp *op)
 {
-    c->PC = c->V[0] + (opCode & 0x0FFF);
+    c->PC = c->V[0] + op->nnn;
 
-    increasePC = false;
+    c->increasePC = false;
     return true;
 }
 
 // Cxkk | RND Vx, byte - Set Vx = random byte AND kk
-bool nibC(unsigned short opCode, Chip8 *c)
+static bool opCxkk(Chip8 *c, const Chip8DecodedOp *op)
 {
-    c->V[(opCode & 0x0F00) >> 8] = (rand() % 256) & (opCode & 0x00FF);
+    c->V[op->x] = chip8_random(c) & op->kk;
     return true;
 }
 
-// Dxyn | DRW Vx, Vy, nibble - Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision
-bool nibD(unsigned short opCode, Chip8 *c)
+bool chip8_drawSprite(Chip8 *c, unsigned char wishX, unsigned char wishY, unsigned char height, unsigned short I)
 {
-    unsigned char wishX = c->V[(opCode & 0x0F00) >> 8];
-    unsigned char wishY = c->V[(opCode & 0x00F0) >> 4];
-    unsigned char height = opCode & 0x000F;
-    unsigned char sprByte; // Each byte represents the whole row of pixels
-    unsigned short finalX, finalY;
-
-    // No collision by default
-    c->V[0xF] = 0;
+    unsigned int shift = wishX % CHIP8_GFX_W;
+    bool collision = false;
 
     for (int line = 0; line < height; line++)
     {
-        // (wishY + line) % CHIP8_GFX_H for a Y value inside the CHIP8_GFX_H limits
-        finalY = (wishY + line) % CHIP8_GFX_H * CHIP8_GFX_W;
+        // Each sprite byte is a row of 8 pixels, placed at the left of the display row
+        uint64_t sprite = (uint64_t)c->memory[ADDR(I + line)] << (CHIP8_GFX_W - 8);
 
-        sprByte = c->memory[c->I + line];
-        for(int column = 0; column < 8; column++)
-        {
-            /* Check if the bit (in sprByte) at position defined by 'column',
-             * from left to right (0b10000000 >> column), is not 0
-             */
-            if((sprByte & (0b10000000 >> column)) != 0) {
-                // Set the X position, inside the CHIP8_GFX_W limits, for the spr pixel
-                finalX = (wishX + column) % CHIP8_GFX_W; // 1
-
-                // Collision
-                if(c->gfx[finalY + finalX])
-                    c->V[0xF] = 1;
-
-                c->gfx[finalY + finalX] ^= 1;
-            }
-        }
+        // Rotate it to wishX, so the pixels past the right edge wrap around to the left
+        if (shift != 0)
+            sprite = sprite >> shift | sprite << (CHIP8_GFX_W - shift);
+
+        unsigned int y = (wishY + line) % CHIP8_GFX_H;
+        uint64_t *row = &c->gfx[y];
+
+        c->dirtyRows |= (uint32_t)1 << y;
+
+        // Collision when any of the sprite pixels is already set
+        collision |= (*row & sprite) != 0;
+        *row ^= sprite;
     }
 
+    CHIP8_PROFILED(c->profile.draws++; c->profile.collisions += collision;)
+
+    return collision;
+}
+
+// Dxyn | DRW Vx, Vy, nibble - Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision
+static bool opDxyn(Chip8 *c, const Chip8DecodedOp *op)
+{
+    c->V[0xF] = chip8_drawSprite(c, c->V[op->x], c->V[op->y], op->kk & 0x0F, c->I);
+
     c->drawFlag = true;
 
     return true;
 }
 
-// Ennn
-bool nibE(unsigned short opCode, Chip8 *c)
+// Ex9E | SKP Vx - Skip next instruction if key with the value of Vx is pressed
+static bool opEx9E(Chip8 *c, const Chip8DecodedOp *op)
 {
-    switch (opCode & 0x00FF)
-    {
-    case 0x009E: // Ex9E | SKP Vx - Skip next instruction if key with the value of Vx is pressed
-        if (c->key[ c->V[(opCode & 0x0F00) >> 8] ])
-            c->PC += 2;
-        break;
+    if (c->key[ c->V[op->x] & 0xF ])
+        c->PC += 2;
 
-    case 0x00A1: // ExA1 | SKNP Vx - Skip next instruction if key with the value of Vx is not pressed
-        if (!c->key[ c->V[(opCode & 0x0F00) >> 8] ])
-            c->PC += 2;
-        break;
+    return true;
+}
 
-    default:
-        return false;
+// ExA1 | SKNP Vx - Skip next instruction if key with the value of Vx is not pressed
+static bool opExA1(Chip8 *c, const Chip8DecodedOp *op)
+{
+    if (!c->key[ c->V[op->x] & 0xF ])
+        c->PC += 2;
+
+    return true;
+}
+
+// Fx07 | LD Vx, DT - Set Vx = delay timer value
+static bool opFx07(Chip8 *c, const Chip8DecodedOp *op)
+{
+    c->V[op->x] = c->dt;
+
+    return true;
+}
+
+// Fx0A | LD Vx, K - Wait for a key press, store the value of the key in Vx
+static bool opFx0A(Chip8 *c, const Chip8DecodedOp *op)
+{
+    for(int i=0; i<16; i++) {
+        if (c->key[i]) {
+            c->V[op->x] = i;
+            return true;
+        }
     }
 
+    // Repeat instruction if none of the keys are being pressed
+    c->increasePC = false;
+    return true;
+}
+
+// Fx15 | LD DT, Vx - Set delay timer = Vx
+static bool opFx15(Chip8 *c, const Chip8DecodedOp *op)
+{
+    c->dt = c->V[op->x];
+
     return true;
 }
 
-// Fnnn
-bool nibF(unsigned short opCode, Chip8 *c)
+// Fx18 | LD ST, Vx - Set sound timer = Vx
+static bool opFx18(Chip8 *c, const Chip8DecodedOp *op)
 {
-    switch (opCode & 0x00FF)
+    c->st = c->V[op->x];
+
+    return true;
+}
+
+// Fx1E | ADD I, Vx - Set I = I + Vx
+static bool opFx1E(Chip8 *c, const Chip8DecodedOp *op)
+{
+    c->I += c->V[op->x];
+
+    return true;
+}
+
+// Fx29 | LD F, Vx - Set I = location of sprite for digit Vx
+static bool opFx29(Chip8 *c, const Chip8DecodedOp *op)
+{
+    c->I = c->V[op->x] * 5;
+
+    return true;
+}
+
+// Fx33 | LD B, Vx - Store BCD representation of Vx in memory locations I, I+1, and I+2
+static bool opFx33(Chip8 *c, const Chip8DecodedOp *op)
+{
+    unsigned char Vx = c->V[op->x];
+
+    c->memory[ADDR(c->I)]     = Vx / 100;
+    c->memory[ADDR(c->I + 1)] = (Vx / 10) % 10;
+    c->memory[ADDR(c->I + 2)] = (Vx % 100) % 10;
+
+    // The written bytes might hold already decoded instructions
+    chip8_invalidateCode(c, ADDR(c->I), 3);
+    return true;
+}
+
+// Fx55 | LD [I], Vx - Store registers V0 through Vx in memory starting at location I
+static bool opFx55(Chip8 *c, const Chip8DecodedOp *op)
+{
+    unsigned char x = op->x;
+
+    for(int i=0; i <= x; i++) {
+        c->memory[ADDR(c->I + i)] = c->V[i];
+    }
+
+    // The written bytes might hold already decoded instructions
+    chip8_invalidateCode(c, ADDR(c->I), x + 1);
+    return true;
+}
+
+// Fx65 | LD Vx, [I] - Read registers V0 through Vx from memory starting at location I
+static bool opFx65(Chip8 *c, const Chip8DecodedOp *op)
+{
+    for (int i = 0; i <= op->x; i++) {
+        c->V[i] = c->memory[ADDR(c->I + i)];
+    }
+
+    return true;
+}
+
+static const OpHandler opHandlers[OP_COUNT] = {
+    [OP_UNDECODED] = &opInvalid, [OP_INVALID] = &opInvalid,
+    [OP_00E0] = &op00E0, [OP_00EE] = &op00EE, [OP_1nnn] = &op1nnn, [OP_2nnn] = &op2nnn,
+    [OP_3xkk] = &op3xkk, [OP_4xkk] = &op4xkk, [OP_5xy0] = &op5xy0, [OP_6xkk] = &op6xkk,
+    [OP_7xkk] = &op7xkk, [OP_8xy0] = &op8xy0, [OP_8xy1] = &op8xy1, [OP_8xy2] = &op8xy2,
+    [OP_8xy3] = &op8xy3, [OP_8xy4] = &op8xy4, [OP_8xy5] = &op8xy5, [OP_8xy6] = &op8xy6,
+    [OP_8xy7] = &op8xy7, [OP_8xyE] = &op8xyE, [OP_9xy0] = &op9xy0, [OP_Annn] = &opAnnn,
+    [OP_Bnnn] = &opBnnn, [OP_Cxkk] = &opCxkk, [OP_Dxyn] = &opDxyn, [OP_Ex9E] = &opEx9E,
+    [OP_ExA1] = &opExA1, [OP_Fx07] = &opFx07, [OP_Fx0A] = &opFx0A, [OP_Fx15] = &opFx15,
+    [OP_Fx18] = &opFx18, [OP_Fx1E] = &opFx1E, [OP_Fx29] = &opFx29, [OP_Fx33] = &opFx33,
+    [OP_Fx55] = &opFx55, [OP_Fx65] = &opFx65,
+};
+
+/*
+ * Direct-threaded version of the interpreter: every instruction jumps straight
+ * into the next one's code (computed goto on GCC/Clang, a switch elsewhere),
+ * and PC, I, V and the timers are kept in locals for the whole slice.
+ * It mirrors chip8_step()/chip8_runFor() exactly, including when the timers
+ * tick and why the slice stops, so both cores produce the same machine state.
+ */
+static Chip8StopReason chip8_runThreaded(Chip8 *c, unsigned int maxCycles, bool sounding)
+{
+    unsigned short PC = c->PC;
+    unsigned short I = c->I;
+    unsigned char V[16];
+    unsigned char dt = c->dt;
+    unsigned char st = c->st;
+    long budget = c->budget;
+    unsigned long long clock = c->clock;
+    unsigned long timerCycles = c->timerCycles;
+    const unsigned long timerPeriod = c->timerPeriod;
+    const Chip8CostModel costModel = c->costModel;
+    const bool timed = c->cycleFrequency > 0;
+    const bool shiftQuirk = c->shiftQuirk;
+    unsigned int cycle = 0;
+    unsigned short pc = PC;
+    unsigned int cost = 0;
+    unsigned int skipCost = 0;
+    const Chip8DecodedOp *op;
+    Chip8StopReason reason;
+    unsigned char Vf;
+    Chip8Trace *const trace = c->trace;
+    unsigned short traceOpCode = 0;
+    bool traced = false; // Whether the instruction at pc still has to be recorded, once it ran
+
+    // Each instruction is timed up to the dispatch of the next one
+    CHIP8_PROFILED(unsigned char profileHandler = OP_UNDECODED; unsigned short profilePc = 0; unsigned long long profileStart = 0;)
+
+    memcpy(V, c->V, sizeof(V));
+
+    c->drawFlag = false;
+
+    // Build with -DCHIP8_NO_COMPUTED_GOTO to force the portable switch
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(CHIP8_NO_COMPUTED_GOTO)
+    static void *const labels[OP_COUNT] = {
+        [OP_UNDECODED] = &&L_INVALID, [OP_INVALID] = &&L_INVALID,
+        [OP_00E0] = &&L_00E0, [OP_00EE] = &&L_00EE, [OP_1nnn] = &&L_1nnn, [OP_2nnn] = &&L_2nnn,
+        [OP_3xkk] = &&L_3xkk, [OP_4xkk] = &&L_4xkk, [OP_5xy0] = &&L_5xy0, [OP_6xkk] = &&L_6xkk,
+        [OP_7xkk] = &&L_7xkk, [OP_8xy0] = &&L_8xy0, [OP_8xy1] = &&L_8xy1, [OP_8xy2] = &&L_8xy2,
+        [OP_8xy3] = &&L_8xy3, [OP_8xy4] = &&L_8xy4, [OP_8xy5] = &&L_8xy5, [OP_8xy6] = &&L_8xy6,
+        [OP_8xy7] = &&L_8xy7, [OP_8xyE] = &&L_8xyE, [OP_9xy0] = &&L_9xy0, [OP_Annn] = &&L_Annn,
+        [OP_Bnnn] = &&L_Bnnn, [OP_Cxkk] = &&L_Cxkk, [OP_Dxyn] = &&L_Dxyn, [OP_Ex9E] = &&L_Ex9E,
+        [OP_ExA1] = &&L_ExA1, [OP_Fx07] = &&L_Fx07, [OP_Fx0A] = &&L_Fx0A, [OP_Fx15] = &&L_Fx15,
+        [OP_Fx18] = &&L_Fx18, [OP_Fx1E] = &&L_Fx1E, [OP_Fx29] = &&L_Fx29, [OP_Fx33] = &&L_Fx33,
+        [OP_Fx55] = &&L_Fx55, [OP_Fx65] = &&L_Fx65,
+    };
+#    define DISPATCH() goto *labels[op->op];
+#    define OPCODE(name) L_##name:
+#    define OPCODE_UNKNOWN
+#else
+#    define DISPATCH() switch (op->op)
+#    define OPCODE(name) case OP_##name:
+#    define OPCODE_UNKNOWN default:
+#endif
+
+// Record the instruction at pc, unless it already was
+#define TRACE_RAN()                                                               \
+    if (traced)                                                                   \
+    {                                                                             \
+        trace_instruction(trace, pc, traceOpCode, I, V);                          \
+        traced = false;                                                           \
+    }
+
+// Move PC forward by the given amount and go run the next instruction
+#define NEXT(advance) do { PC += (advance); goto spend; } while (0)
+
+// Same arithmetic as chip8_advanceClock() for the instruction that ran at pc, so the ticks land on the same instructions
+#define SPEND()                                                                   \
+    if (timed)                                                                    \
+    {                                                                             \
+        unsigned int spent = cost + (PC == pc + 4 ? skipCost : 0);                \
+                                                                                  \
+        clock += spent;                                                           \
+        budget -= spent;                                                          \
+        timerCycles += spent;                                                     \
+                                                                                  \
+        while (timerCycles >= timerPeriod)                                        \
+        {                                                                         \
+            timerCycles -= timerPeriod;                                           \
+                                                                                  \
+            dt = (dt - 1 > 0) ? dt - 1 : 0;                                       \
+            st = (st - 1 > 0) ? st - 1 : 0;                                       \
+        }                                                                         \
+    }
+
+// Let chip8_skipIdle() go through the spin loop at PC, handing it the locals and taking them back
+#define SKIP_IDLE()                                                               \
+    do                                                                            \
+    {                                                                             \
+        TRACE_RAN();                                                              \
+        c->PC = PC;                                                               \
+        c->dt = dt;                                                               \
+        c->st = st;                                                               \
+        c->budget = budget;                                                       \
+        c->clock = clock;                                                         \
+        c->timerCycles = timerCycles;                                             \
+        memcpy(c->V, V, sizeof(V));                                               \
+                                                                                  \
+        cycle += chip8_skipIdle(c, maxCycles - cycle);                            \
+                                                                                  \
+        dt = c->dt;                                                               \
+        st = c->st;                                                               \
+        budget = c->budget;                                                       \
+        clock = c->clock;                                                         \
+        timerCycles = c->timerCycles;                                             \
+        memcpy(V, c->V, sizeof(V));                                               \
+    } while (0)
+
+    goto next;
+
+jumped:
+    SPEND()
+
+    // The jump might have led into a spin loop
+    if (PC < sizeof(c->memory) && IDLE_CANDIDATE(c->decoded[PC].op))
+        SKIP_IDLE();
+
+    goto next;
+
+spend:
+    SPEND()
+
+next:
+    // Notify the host about the sound timer starting or stopping
+    if ((st > 0) != sounding)
     {
-    case 0x0007: // Fx07 | LD Vx, DT - Set Vx = delay timer value
-        c->V[(opCode & 0x0F00) >> 8] = c->dt;
-        break;
+        reason = CHIP8_STOP_SOUND;
+        goto leave;
+    }
 
-    case 0x000A: // Fx0A | LD Vx, K - Wait for a key press, store the value of the key in Vx
-        for(int i=0; i<16; i++) {
-            if (c->key[i]) {
-                c->V[(opCode & 0x0F00) >> 8] = i;
-                return true;
-            }
-        }
+    if (cycle == maxCycles || (timed && budget <= 0))
+    {
+        reason = CHIP8_STOP_BUDGET;
+        goto leave;
+    }
 
-        // Repeat instruction if none of the keys are being pressed
-        increasePC = false;
-        break;
+    // The opCode at PC needs both of its bytes inside the memory
+    if (PC >= sizeof(c->memory) - 1)
+    {
+        fprintf(stderr, "Error: PC exceeded the memory limits.");
+        reason = CHIP8_STOP_ERROR;
+        goto leave;
+    }
 
-    case 0x0015: // Fx15 | LD DT, Vx - Set delay timer = Vx
-        c->dt = c->V[(opCode & 0x0F00) >> 8];
-        break;
+    cycle++;
 
-    case 0x0018: // Fx18 | LD ST, Vx - Set sound timer = Vx
-        c->st = c->V[(opCode & 0x0F00) >> 8];
-        break;
+    if (c->decoded[PC].op == OP_UNDECODED)
+        chip8_decode(c, PC);
 
-    case 0x001E: // Fx1E | ADD I, Vx - Set I = I + Vx
-        c->I += c->V[(opCode & 0x0F00) >> 8];
-        break;
+    // The previous instruction is recorded now that it ran, along with the opCode of this one before it runs
+    if (trace != NULL)
+    {
+        TRACE_RAN()
+        traceOpCode = c->memory[PC] << 8 | c->memory[PC + 1];
+        traced = true;
+    }
 
-    case 0x0029: // Fx29 | LD F, Vx - Set I = location of sprite for digit Vx
-        c->I = c->V[(opCode & 0x0F00) >> 8] * 5;
-        break;
+    op = &c->decoded[PC];
+    pc = PC;
 
-    case 0x0033: // Fx33 | LD B, Vx - Store BCD representation of Vx in memory locations I, I+1, and I+2
-        c->memory[c->I]     = c->V[(opCode & 0x0F00) >> 8] / 100;
-        c->memory[c->I + 1] = (c->V[(opCode & 0x0F00) >> 8] / 10) % 10;
-        c->memory[c->I + 2] = (c->V[(opCode & 0x0F00) >> 8] % 100) % 10;
-        break;
+    CHIP8_PROFILED(
+        unsigned long long profileNow = chip8_profileTicks();
+
+        if (profileHandler != OP_UNDECODED)
+            chip8_profileInstruction(&c->profile, profileHandler, profilePc, profileNow - profileStart);
+
+        profileHandler = op->op;
+        profilePc = pc;
+        profileStart = profileNow;)
+
+    // Priced before running, as the instruction might overwrite its own decoded entry
+    if (timed)
+        cost = chip8_cost(costModel, op, &skipCost);
 
-    case 0x0055: // Fx55 | LD [I], Vx - Store registers V0 through Vx in memory starting at location I
-        for(int i=0; i <= (opCode & 0x0F00) >> 8; i++) {
-            c->memory[c->I + i] = c->V[i];
+    DISPATCH()
+    {
+    OPCODE_UNKNOWN
+    OPCODE(INVALID)
+        goto fail;
+
+    OPCODE(00E0)
+        memset(c->gfx, false, sizeof(c->gfx));
+        c->dirtyRows = UINT32_MAX;
+        PC += 2;
+        goto drawn;
+
+    OPCODE(00EE)
+        if (c->SP <= 0) {
+            fprintf(stderr, "Stack underflow\n");
+            goto fail;
         }
-        break;
 
-    case 0x0065: // Fx65 | LD Vx, [I] - Read registers V0 through Vx from memory starting at location I
-        for (int i = 0; i <= (opCode & 0x0F00) >> 8; i++) {
-            c->V[i] = c->memory[c->I + i];
+        c->SP--;
+        NEXT(c->stack[c->SP] + 2 - PC);
+
+    OPCODE(1nnn)
+        PC = op->nnn;
+        goto jumped;
+
+    OPCODE(2nnn)
+        if (c->SP >= 15) {
+            fprintf(stderr, "Stack overflow\n");
+            goto fail;
         }
-        break;
 
-    default:
-        return false;
+        c->stack[c->SP] = PC;
+        c->SP++;
+        NEXT(op->nnn - PC);
+
+    OPCODE(3xkk)
+        NEXT(V[op->x] == op->kk ? 4 : 2);
+
+    OPCODE(4xkk)
+        NEXT(V[op->x] != op->kk ? 4 : 2);
+
+    OPCODE(5xy0)
+        NEXT(V[op->x] == V[op->y] ? 4 : 2);
+
+    OPCODE(6xkk)
+        V[op->x] = op->kk;
+        NEXT(2);
+
+    OPCODE(7xkk)
+        V[op->x] += op->kk;
+        NEXT(2);
+
+    OPCODE(8xy0)
+        V[op->x] = V[op->y];
+        NEXT(2);
+
+    OPCODE(8xy1)
+        V[op->x] |= V[op->y];
+        NEXT(2);
+
+    OPCODE(8xy2)
+        V[op->x] &= V[op->y];
+        NEXT(2);
+
+    OPCODE(8xy3)
+        V[op->x] ^= V[op->y];
+        NEXT(2);
+
+    OPCODE(8xy4)
+        Vf = V[op->x] + V[op->y] > 0xFF;
+        V[op->x] += V[op->y];
+        V[0xF] = Vf;
+        NEXT(2);
+
+    OPCODE(8xy5)
+        Vf = V[op->x] >= V[op->y];
+        V[op->x] -= V[op->y];
+        V[0xF] = Vf;
+        NEXT(2);
+
+    OPCODE(8xy6)
+        if (!shiftQuirk)
+            V[op->x] = V[op->y];
+
+        Vf = V[op->x] & 1;
+        V[op->x] >>= 1;
+        V[0xF] = Vf;
+        NEXT(2);
+
+    OPCODE(8xy7)
+        Vf = V[op->y] >= V[op->x];
+        V[op->x] = V[op->y] - V[op->x];
+        V[0xF] = Vf;
+        NEXT(2);
+
+    OPCODE(8xyE)
+        if (!shiftQuirk)
+            V[op->x] = V[op->y];
+
+        Vf = V[op->x] >> 7;
+        V[op->x] <<= 1;
+        V[0xF] = Vf;
+        NEXT(2);
+
+    OPCODE(9xy0)
+        NEXT(V[op->x] != V[op->y] ? 4 : 2);
+
+    OPCODE(Annn)
+        I = op->nnn;
+        NEXT(2);
+
+    OPCODE(Bnnn)
+        NEXT(V[0] + op->nnn - PC);
+
+    OPCODE(Cxkk)
+        V[op->x] = chip8_random(c) & op->kk;
+        NEXT(2);
+
+    OPCODE(Dxyn)
+        V[0xF] = chip8_drawSprite(c, V[op->x], V[op->y], op->kk & 0x0F, I);
+        PC += 2;
+        goto drawn;
+
+    OPCODE(Ex9E)
+        NEXT(c->key[V[op->x] & 0xF] ? 4 : 2);
+
+    OPCODE(ExA1)
+        NEXT(!c->key[V[op->x] & 0xF] ? 4 : 2);
+
+    OPCODE(Fx07)
+        V[op->x] = dt;
+        NEXT(2);
+
+    OPCODE(Fx0A)
+        for (int i = 0; i < 16; i++) {
+            if (c->key[i]) {
+                V[op->x] = i;
+                NEXT(2);
+            }
+        }
+
+        // Repeat instruction once a key is pressed
+        SPEND()
+        reason = (st > 0) != sounding ? CHIP8_STOP_SOUND : CHIP8_STOP_KEY_WAIT;
+
+        // Nothing changes until then, the wait goes on up to the next tick at once
+        if (reason == CHIP8_STOP_KEY_WAIT)
+            SKIP_IDLE();
+
+        goto leave;
+
+    OPCODE(Fx15)
+        dt = V[op->x];
+        NEXT(2);
+
+    OPCODE(Fx18)
+        st = V[op->x];
+        NEXT(2);
+
+    OPCODE(Fx1E)
+        I += V[op->x];
+        NEXT(2);
+
+    OPCODE(Fx29)
+        I = V[op->x] * 5;
+        NEXT(2);
+
+    OPCODE(Fx33)
+        c->memory[ADDR(I)]     = V[op->x] / 100;
+        c->memory[ADDR(I + 1)] = (V[op->x] / 10) % 10;
+        c->memory[ADDR(I + 2)] = V[op->x] % 10;
+        chip8_invalidateCode(c, ADDR(I), 3);
+        NEXT(2);
+
+    OPCODE(Fx55)
+        for (int i = 0; i <= op->x; i++)
+            c->memory[ADDR(I + i)] = V[i];
+        chip8_invalidateCode(c, ADDR(I), op->x + 1);
+        NEXT(2);
+
+    OPCODE(Fx65)
+        for (int i = 0; i <= op->x; i++)
+            V[i] = c->memory[ADDR(I + i)];
+        NEXT(2);
     }
 
-    return true;
+#undef DISPATCH
+#undef OPCODE
+#undef OPCODE_UNKNOWN
+#undef NEXT
+
+drawn:
+    SPEND()
+    c->drawFlag = true;
+    reason = CHIP8_STOP_DRAW;
+    goto leave;
+
+fail:
+    fprintf(stderr, "PC: %d | Invalid opCode: 0x%X", PC, c->memory[PC] << 8 | c->memory[PC + 1]);
+    PC += 2;
+    SPEND()
+    reason = CHIP8_STOP_ERROR;
+
+#undef SPEND
+#undef SKIP_IDLE
+
+leave:
+    TRACE_RAN()
+#undef TRACE_RAN
+
+    CHIP8_PROFILED(
+        if (profileHandler != OP_UNDECODED)
+            chip8_profileInstruction(&c->profile, profileHandler, profilePc, chip8_profileTicks() - profileStart);)
+
+    c->cycles += cycle;
+    c->PC = PC;
+    c->I = I;
+    memcpy(c->V, V, sizeof(V));
+    c->dt = dt;
+    c->st = st;
+    c->budget = budget;
+    c->clock = clock;
+    c->timerCycles = timerCycles;
+
+    return reason;
 }
 
 void chip8_init(Chip8 *chip8, int processor_freq)
@@ -508,6 +1477,9 @@ void chip8_init(Chip8 *chip8, int processor_freq)
     // Quirks activated by default
     chip8->shiftQuirk = true;
 
+    // Same numbers on every run until seeded otherwise
+    chip8_seed(chip8, 0);
+
     // Clear stack
     memset(chip8->stack, 0, sizeof(chip8->stack));
 
@@ -520,24 +1492,306 @@ void chip8_init(Chip8 *chip8, int processor_freq)
     // Copy the sprites to the interpreter area of memory
     memcpy(chip8->memory, SPRITES, sizeof(SPRITES));
 
-    // Map decode functions to decodeByHighestNibble
-    memcpy(
-        decodeByHighestNibble,
-        (bool (*[16])(unsigned short, Chip8 *)){
-            &nib0, &nib1, &nib2, &nib3, &nib4, &nib5, &nib6, &nib7,
-            &nib8, &nib9, &nibA, &nibB, &nibC, &nibD, &nibE, &nibF,
-        },
-        sizeof(decodeByHighestNibble)
-    );
+    // Nothing decoded yet
+    memset(chip8->decoded, 0, sizeof(chip8->decoded));
+
+    // Nothing tracked yet
+    chip8->dirtyPages = 0;
+    chip8->dirtyRows = 0;
+    CHIP8_PROFILED(memset(&chip8->profile, 0, sizeof(chip8->profile));)
+
+    // Timing. The flat cost makes the timers tick every processor_freq cycles, so both frequencies are exact
+    chip8->costModel = CHIP8_COST_FLAT;
+    chip8->cycleFrequency = processor_freq <= 0 ? 0 : (unsigned long)processor_freq * CHIP8_FLAT_COST;
+    chip8->timerPeriod = processor_freq <= 0 ? 0 : (unsigned long)processor_freq;
+    chip8->timerCycles = 0;
+    chip8->clock = 0;
+    chip8->budget = 0;
+    chip8->budgetFraction = 0;
+    chip8->tTimerRegistersFrequency = 0;
+    chip8->increasePC = true;
+
+    chip8->core = CHIP8_CORE_INTERPRETER;
+    chip8->trace = NULL;
+    chip8->cycles = 0;
+}
 
-    processor_timestep = processor_freq <= 0 ? 0 : 1.0 / processor_freq;
+void chip8_seed(Chip8 *chip8, uint64_t seed)
+{
+    // xorshift never leaves 0, so it can't be a state
+    chip8->rng = seed != 0 ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+unsigned char chip8_random(Chip8 *chip8)
+{
+    uint64_t x = chip8->rng;
 
-    if (processor_timestep <= 0)
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    chip8->rng = x;
+
+    // The highest bits of the product are the most random ones
+    return (x * 0x2545F4914F6CDD1DULL) >> 56;
+}
+
+void chip8_setCostModel(Chip8 *chip8, Chip8CostModel model)
+{
+    chip8->costModel = model;
+
+    if (model == CHIP8_COST_VIP && chip8->cycleFrequency > 0)
     {
-        printf("Starting Chip-8 at an unrestricted frequency.\n");
+        chip8->cycleFrequency = CHIP8_VIP_CYCLE_FREQUENCY;
+        chip8->timerPeriod = CHIP8_VIP_CYCLE_FREQUENCY / CHIP8_TIMERS_FREQUENCY;
+        chip8->timerCycles = 0;
     }
-    else
+}
+
+// The fields fill the state exactly, so its bytes are fully defined and the same on every build
+_Static_assert(sizeof(Chip8State) == offsetof(Chip8State, padding) + 1 && sizeof(Chip8State) % sizeof(uint64_t) == 0,
+               "Chip8State must not have padding");
+
+// FNV-1a over the 64-bit words after the state header, on 4 lanes so the multiplications overlap
+static uint64_t chip8_stateChecksum(const Chip8State *state)
+{
+    const unsigned char *bytes = (const unsigned char *)state + offsetof(Chip8State, gfx);
+    size_t words = (sizeof(Chip8State) - offsetof(Chip8State, gfx)) / sizeof(uint64_t);
+    uint64_t a = 14695981039346656037ULL, b = a ^ 1, c = a ^ 2, d = a ^ 3;
+    uint64_t word[4];
+    size_t i = 0;
+
+    for (; i + 4 <= words; i += 4)
+    {
+        memcpy(word, bytes + i * sizeof(uint64_t), sizeof(word));
+        a = (a ^ word[0]) * 1099511628211ULL;
+        b = (b ^ word[1]) * 1099511628211ULL;
+        c = (c ^ word[2]) * 1099511628211ULL;
+        d = (d ^ word[3]) * 1099511628211ULL;
+    }
+
+    for (; i < words; i++)
+    {
+        memcpy(word, bytes + i * sizeof(uint64_t), sizeof(uint64_t));
+        a = (a ^ word[0]) * 1099511628211ULL;
+    }
+
+    return a ^ (b << 16 | b >> 48) ^ (c << 32 | c >> 32) ^ (d << 48 | d >> 16);
+}
+
+void chip8_saveState(const Chip8 *chip8, Chip8State *state)
+{
+    state->magic = CHIP8_STATE_MAGIC;
+    state->version = CHIP8_STATE_VERSION;
+    state->size = sizeof(Chip8State);
+    state->reserved = 0;
+
+    memcpy(state->gfx, chip8->gfx, sizeof(state->gfx));
+    state->cycles = chip8->cycles;
+    state->clock = chip8->clock;
+    state->cycleFrequency = chip8->cycleFrequency;
+    state->timerPeriod = chip8->timerPeriod;
+    state->timerCycles = chip8->timerCycles;
+    state->rng = chip8->rng;
+    state->budget = chip8->budget;
+    state->budgetFraction = chip8->budgetFraction;
+    state->tTimerRegistersFrequency = chip8->tTimerRegistersFrequency;
+
+    state->costModel = chip8->costModel;
+    state->I = chip8->I;
+    state->PC = chip8->PC;
+    memcpy(state->stack, chip8->stack, sizeof(state->stack));
+
+    memcpy(state->memory, chip8->memory, sizeof(state->memory));
+    memcpy(state->V, chip8->V, sizeof(state->V));
+    state->SP = chip8->SP;
+    state->dt = chip8->dt;
+    state->st = chip8->st;
+
+    for (int i = 0; i < 16; i++)
+        state->key[i] = chip8->key[i];
+
+    state->shiftQuirk = chip8->shiftQuirk;
+    state->drawFlag = chip8->drawFlag;
+    state->padding = 0;
+
+    state->checksum = chip8_stateChecksum(state);
+}
+
+bool chip8_loadState(Chip8 *chip8, const Chip8State *state)
+{
+    if (state->magic != CHIP8_STATE_MAGIC || state->version != CHIP8_STATE_VERSION || state->size != sizeof(Chip8State))
+    {
+        fprintf(stderr, "The state wasn't saved by this version of the emulator.\n");
+        return false;
+    }
+
+    if (state->checksum != chip8_stateChecksum(state))
+    {
+        fprintf(stderr, "The state is corrupted.\n");
+        return false;
+    }
+
+    // A valid checksum doesn't make the values sane, and the cores trust these ones
+    if (state->SP > sizeof(state->stack) / sizeof(state->stack[0]) || state->costModel > CHIP8_COST_VIP ||
+        (state->cycleFrequency > 0 && state->timerPeriod == 0))
+    {
+        fprintf(stderr, "The state holds a machine that can't run.\n");
+        return false;
+    }
+
+    // States forked from the same run share most of their code, whose decoded instructions still hold
+    for (unsigned int address = 0; address < sizeof(chip8->memory); address += sizeof(uint64_t))
+    {
+        uint64_t current, saved;
+
+        memcpy(&current, chip8->memory + address, sizeof(current));
+        memcpy(&saved, state->memory + address, sizeof(saved));
+
+        if (current != saved)
+            chip8_invalidateCode(chip8, address, sizeof(uint64_t));
+    }
+
+    for (int row = 0; row < CHIP8_GFX_H; row++)
     {
-        printf("Starting Chip-8 at %uHz.\n", processor_freq);
+        if (chip8->gfx[row] != state->gfx[row])
+            chip8->dirtyRows |= (uint32_t)1 << row;
+    }
+
+    memcpy(chip8->gfx, state->gfx, sizeof(chip8->gfx));
+    chip8->cycles = state->cycles;
+    chip8->clock = state->clock;
+    chip8->cycleFrequency = state->cycleFrequency;
+    chip8->timerPeriod = state->timerPeriod;
+    chip8->timerCycles = state->timerCycles;
+    chip8->rng = state->rng;
+    chip8->budget = state->budget;
+    chip8->budgetFraction = state->budgetFraction;
+    chip8->tTimerRegistersFrequency = state->tTimerRegistersFrequency;
+
+    chip8->costModel = state->costModel;
+    chip8->I = state->I;
+    chip8->PC = state->PC;
+    memcpy(chip8->stack, state->stack, sizeof(chip8->stack));
+
+    memcpy(chip8->memory, state->memory, sizeof(chip8->memory));
+    memcpy(chip8->V, state->V, sizeof(chip8->V));
+    chip8->SP = state->SP;
+    chip8->dt = state->dt;
+    chip8->st = state->st;
+
+    for (int i = 0; i < 16; i++)
+        chip8->key[i] = state->key[i];
+
+    chip8->shiftQuirk = state->shiftQuirk;
+    chip8->drawFlag = state->drawFlag;
+
+    return true;
+}
+
+#ifdef CHIP8_PROFILE
+void chip8_profileJson(const Chip8Profile *profile, const char *name, FILE *fp)
+{
+    unsigned long long executed = 0;
+
+    for (int handler = 0; handler < OP_COUNT; handler++)
+        executed += profile->executed[handler];
+
+    fprintf(fp, "{\"name\": \"");
+
+    // Rom paths are the only names, which just need their quotes and backslashes escaped
+    for (const char *c = name; *c != '\0'; c++)
+        fprintf(fp, *c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+
+    fprintf(fp, "\", \"tick_unit\": \"%s\", \"executed\": %llu, \"native\": %llu, \"draws\": %llu, \"collisions\": %llu, ",
+#    if defined(__x86_64__) || defined(__i386__)
+            "tsc",
+#    else
+            "ns",
+#    endif
+            executed, profile->nativeInstructions, profile->draws, profile->collisions);
+    fprintf(fp, "\"timer_wait_cycles\": %llu, \"key_wait_cycles\": %llu, \"spin_cycles\": %llu, ",
+            profile->timerWaitCycles, profile->keyWaitCycles, profile->spinCycles);
+
+    // Handlers grouped by their highest nibble, which is what the decoding goes by
+    fprintf(fp, "\"nibbles\": {");
+
+    for (int nibble = 0, first = 1; nibble < 16; nibble++)
+    {
+        char digit = "0123456789ABCDEF"[nibble];
+        unsigned long long count = 0, ticks = 0;
+
+        for (int handler = OP_INVALID + 1; handler < OP_COUNT; handler++)
+        {
+            if (OP_NAMES[handler][0] == digit)
+            {
+                count += profile->executed[handler];
+                ticks += profile->ticks[handler];
+            }
+        }
+
+        if (count == 0)
+            continue;
+
+        fprintf(fp, "%s\"%c\": {\"executed\": %llu, \"ticks\": %llu}", first ? "" : ", ", digit, count, ticks);
+        first = 0;
+    }
+
+    fprintf(fp, "}, \"handlers\": {");
+
+    for (int handler = 0, first = 1; handler < OP_COUNT; handler++)
+    {
+        if (profile->executed[handler] == 0)
+            continue;
+
+        fprintf(fp, "%s\"%s\": {\"executed\": %llu, \"ticks\": %llu}", first ? "" : ", ", OP_NAMES[handler],
+                profile->executed[handler], profile->ticks[handler]);
+        first = 0;
+    }
+
+    // Hottest addresses first
+    fprintf(fp, "}, \"addresses\": [");
+
+    unsigned short order[4096];
+    int count = 0;
+
+    for (int pc = 0; pc < 4096; pc++)
+    {
+        if (profile->pcExecuted[pc] == 0)
+            continue;
+
+        int i = count++;
+
+        while (i > 0 && profile->pcExecuted[order[i - 1]] < profile->pcExecuted[pc])
+        {
+            order[i] = order[i - 1];
+            i--;
+        }
+
+        order[i] = pc;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        unsigned short pc = order[i];
+
+        fprintf(fp, "%s{\"pc\": \"0x%03X\", \"handler\": \"%s\", \"executed\": %llu, \"ticks\": %llu}", i > 0 ? ", " : "",
+                pc, OP_NAMES[profile->pcHandler[pc]], profile->pcExecuted[pc], profile->pcTicks[pc]);
+    }
+
+    fprintf(fp, "]}");
+}
+
+void chip8_profileFolded(const Chip8Profile *profile, const char *name, FILE *fp)
+{
+    for (int pc = 0; pc < 4096; pc++)
+    {
+        const char *handler = OP_NAMES[profile->pcHandler[pc]];
+
+        if (profile->pcTicks[pc] == 0)
+            continue;
+
+        fprintf(fp, "%s;nib%c;%s;0x%03X %llu\n", name, profile->pcHandler[pc] > OP_INVALID ? handler[0] : '?', handler, pc,
+                profile->pcTicks[pc]);
     }
 }
+#endif
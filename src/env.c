@@ -0,0 +1,319 @@
+#include "../include/env.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+typedef struct
+{
+    unsigned short address;
+    unsigned char size;
+} EnvHook;
+
+struct Chip8Env
+{
+    unsigned int count;
+    unsigned int frames; // 60Hz frames of virtual time per step
+
+    Chip8 *machines;
+    Chip8State initial;  // Snapshot env_reset() goes back to by default
+    uint64_t *seeds;     // Per machine, 0 when it keeps the generator of the snapshot
+
+    EnvHook hooks[CHIP8_ENV_HOOKS];
+    unsigned int hookCount;
+
+    // Observation region, either the caller's, a shared memory object or the batch's own
+    Chip8EnvHeader *header;
+    Chip8EnvObservation *observations;
+    size_t regionSize;
+    char *sharedName; // Of the shared memory object, NULL otherwise
+    bool ownsRegion;
+};
+
+size_t env_regionSize(unsigned int count)
+{
+    return sizeof(Chip8EnvHeader) + (size_t)count * sizeof(Chip8EnvObservation);
+}
+
+static uint32_t env_readHook(const Chip8 *chip8, const EnvHook *hook)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < hook->size; i++)
+        value = value << 8 | chip8->memory[hook->address + i];
+
+    return value;
+}
+
+// Write everything of the observation of a machine, as after a reset
+static void env_observeAll(Chip8Env *env, unsigned int machine)
+{
+    const Chip8 *chip8 = &env->machines[machine];
+    Chip8EnvObservation *observation = &env->observations[machine];
+
+    memcpy(observation->gfx, chip8->gfx, sizeof(observation->gfx));
+    observation->cycles = chip8->cycles;
+    observation->step = 0;
+    observation->sound = chip8->st > 0;
+    observation->done = false;
+
+    for (unsigned int h = 0; h < CHIP8_ENV_HOOKS; h++)
+    {
+        observation->hooks[h] = h < env->hookCount ? env_readHook(chip8, &env->hooks[h]) : 0;
+        observation->rewards[h] = 0;
+    }
+
+    env->machines[machine].dirtyRows = 0;
+}
+
+// Write what the latest step changed in the observation of a machine
+static void env_observe(Chip8Env *env, unsigned int machine, bool halted)
+{
+    Chip8 *chip8 = &env->machines[machine];
+    Chip8EnvObservation *observation = &env->observations[machine];
+
+    for (uint32_t dirty = chip8->dirtyRows; dirty != 0; dirty &= dirty - 1)
+    {
+        int row = __builtin_ctz(dirty);
+
+        observation->gfx[row] = chip8->gfx[row];
+    }
+
+    chip8->dirtyRows = 0;
+
+    observation->cycles = chip8->cycles;
+    observation->step++;
+    observation->sound = chip8->st > 0;
+    observation->done = halted;
+
+    for (unsigned int h = 0; h < env->hookCount; h++)
+    {
+        uint32_t value = env_readHook(chip8, &env->hooks[h]);
+
+        observation->rewards[h] = (int32_t)(value - observation->hooks[h]);
+        observation->hooks[h] = value;
+    }
+}
+
+// Create the batch over the given region, of which it takes ownership when ownsRegion
+static Chip8Env *env_createIn(const Chip8 *chip8, unsigned int count, unsigned int frames, void *region, bool ownsRegion)
+{
+    if (chip8->cycleFrequency == 0)
+    {
+        fprintf(stderr, "Error: The machines of a batch need a restricted processor frequency.\n");
+        return NULL;
+    }
+
+    Chip8Env *env = calloc(1, sizeof(Chip8Env));
+
+    if (env == NULL || (env->machines = malloc(count * sizeof(Chip8))) == NULL || (env->seeds = calloc(count, sizeof(uint64_t))) == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate the batch of machines.\n");
+
+        if (env != NULL)
+            free(env->machines);
+
+        free(env);
+        return NULL;
+    }
+
+    env->count = count;
+    env->frames = frames;
+    env->header = region;
+    env->observations = (Chip8EnvObservation *)(env->header + 1);
+    env->regionSize = env_regionSize(count);
+    env->ownsRegion = ownsRegion;
+
+    chip8_saveState(chip8, &env->initial);
+
+    env->header->magic = CHIP8_ENV_MAGIC;
+    env->header->version = CHIP8_ENV_VERSION;
+    env->header->count = count;
+    env->header->hooks = 0;
+    env->header->steps = 0;
+
+    // Decoded instructions come along, so the machines start warm
+    for (unsigned int machine = 0; machine < count; machine++)
+    {
+        memcpy(&env->machines[machine], chip8, sizeof(Chip8));
+        env->machines[machine].trace = NULL;
+        env_observeAll(env, machine);
+    }
+
+    return env;
+}
+
+Chip8Env *env_create(const Chip8 *chip8, unsigned int count, unsigned int frames, void *region)
+{
+    if (region != NULL)
+        return env_createIn(chip8, count, frames, region, false);
+
+    region = calloc(1, env_regionSize(count));
+
+    if (region == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate the observations.\n");
+        return NULL;
+    }
+
+    Chip8Env *env = env_createIn(chip8, count, frames, region, true);
+
+    if (env == NULL)
+        free(region);
+
+    return env;
+}
+
+Chip8Env *env_createShared(const Chip8 *chip8, unsigned int count, unsigned int frames, const char *name)
+{
+    size_t size = env_regionSize(count);
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    void *region = MAP_FAILED;
+
+    if (fd >= 0 && ftruncate(fd, size) == 0)
+        region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // The mapping stays valid without the descriptor
+    if (fd >= 0)
+        close(fd);
+
+    if (region == MAP_FAILED)
+    {
+        perror(name);
+
+        if (fd >= 0)
+            shm_unlink(name);
+
+        return NULL;
+    }
+
+    Chip8Env *env = env_createIn(chip8, count, frames, region, false);
+
+    if (env == NULL || (env->sharedName = strdup(name)) == NULL)
+    {
+        if (env != NULL)
+            env_destroy(env);
+
+        munmap(region, size);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    return env;
+}
+
+bool env_addHook(Chip8Env *env, unsigned short address, unsigned char size)
+{
+    if (env->hookCount == CHIP8_ENV_HOOKS || size < 1 || size > 4 || address + size > sizeof(env->initial.memory))
+        return false;
+
+    EnvHook *hook = &env->hooks[env->hookCount];
+
+    hook->address = address;
+    hook->size = size;
+
+    // Rewards count from the value the machines hold now
+    for (unsigned int machine = 0; machine < env->count; machine++)
+    {
+        env->observations[machine].hooks[env->hookCount] = env_readHook(&env->machines[machine], hook);
+        env->observations[machine].rewards[env->hookCount] = 0;
+    }
+
+    env->header->hooks = ++env->hookCount;
+
+    return true;
+}
+
+void env_seed(Chip8Env *env, unsigned int machine, uint64_t seed)
+{
+    env->seeds[machine] = seed;
+    chip8_seed(&env->machines[machine], seed);
+}
+
+void env_step(Chip8Env *env, const uint16_t *actions)
+{
+    // Exactly the same slice every step, whatever the host time
+    double deltaTime = env->frames * CHIP8_TIMERS_TIMESTEP;
+
+    for (unsigned int machine = 0; machine < env->count; machine++)
+    {
+        Chip8 *chip8 = &env->machines[machine];
+
+        if (env->observations[machine].done)
+            continue;
+
+        for (int i = 0; i < 16; i++)
+            chip8->key[i] = actions[machine] >> i & 1;
+
+        // Draws, sound edges and key waits hand control back early, keeping the rest of the budget
+        Chip8StopReason reason = chip8_runFor(chip8, deltaTime, UINT_MAX);
+
+        while (reason != CHIP8_STOP_BUDGET && reason != CHIP8_STOP_ERROR)
+            reason = chip8_runFor(chip8, 0, UINT_MAX);
+
+        env_observe(env, machine, reason == CHIP8_STOP_ERROR);
+    }
+
+    // Readers polling the count see every observation of the step
+    atomic_thread_fence(memory_order_release);
+    env->header->steps++;
+}
+
+bool env_reset(Chip8Env *env, unsigned int machine, const Chip8State *state)
+{
+    Chip8 *chip8 = &env->machines[machine];
+
+    if (state != NULL && state->cycleFrequency == 0)
+    {
+        fprintf(stderr, "Error: The machines of a batch need a restricted processor frequency.\n");
+        return false;
+    }
+
+    if (!chip8_loadState(chip8, state != NULL ? state : &env->initial))
+        return false;
+
+    if (state == NULL && env->seeds[machine] != 0)
+        chip8_seed(chip8, env->seeds[machine]);
+
+    env_observeAll(env, machine);
+
+    return true;
+}
+
+const Chip8EnvHeader *env_header(const Chip8Env *env)
+{
+    return env->header;
+}
+
+const Chip8EnvObservation *env_observation(const Chip8Env *env, unsigned int machine)
+{
+    return &env->observations[machine];
+}
+
+const Chip8 *env_machine(const Chip8Env *env, unsigned int machine)
+{
+    return &env->machines[machine];
+}
+
+void env_destroy(Chip8Env *env)
+{
+    if (env->sharedName != NULL)
+    {
+        munmap(env->header, env->regionSize);
+        shm_unlink(env->sharedName);
+        free(env->sharedName);
+    }
+    else if (env->ownsRegion)
+    {
+        free(env->header);
+    }
+
+    free(env->machines);
+    free(env->seeds);
+    free(env);
+}
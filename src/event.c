@@ -1,23 +1,37 @@
 #include "../include/event.h"
+#include "../include/pacer.h"
+
+#include <stdio.h>
+#include <string.h>
 #include <SDL2/SDL.h>
 
 /*
-    Map the SDL Keycodes to a CHIP-8 key from 0 to F
+    Map the CHIP-8 keys from 0 to F to the keys at these places of the user keyboard,
+    whatever its layout, unless replaced by event_setKeyMap()
     Index: CHIP-8 Keypad
     Value: User keyboard
     +---------+---------+---------+---------+
-    |1: SDLK_1|2: SDLK_2|3: SDLK_3|C: SDLK_4|
+    |1: 1     |2: 2     |3: 3     |C: 4     |
     +---------+---------+---------+---------+
-    |4: SDLK_q|5: SDLK_w|6: SDLK_e|D: SDLK_r|
+    |4: Q     |5: W     |6: E     |D: R     |
     +---------+---------+---------+---------+
-    |7: SDLK_a|8: SDLK_s|9: SDLK_d|E: SDLK_f|
+    |7: A     |8: S     |9: D     |E: F     |
     +---------+---------+---------+---------+
-    |A: SDLK_z|0: SDLK_x|B: SDLK_c|F: SDLK_v|
+    |A: Z     |0: X     |B: C     |F: V     |
     +---------+---------+---------+---------+
 */
-const SDL_Keycode keyMap[16] = {
-    SDLK_x, SDLK_1, SDLK_2, SDLK_3, SDLK_q, SDLK_w, SDLK_e, SDLK_a,
-    SDLK_s, SDLK_d, SDLK_z, SDLK_c, SDLK_4, SDLK_r, SDLK_f, SDLK_v};
+SDL_Scancode keyMap[16] = {
+    SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
+    SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C, SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V};
+
+// CHIP-8 key of each scancode, -1 for the unmapped ones, built from keyMap by event_init()
+signed char keypadOf[SDL_NUM_SCANCODES];
+
+// State of the keypad as of the latest event, one bit per key
+uint16_t keypad = 0;
+
+// The latest state of the keypad didn't fit in the queue yet
+bool keypadPending = false;
 
 SDL_Event e;
 
@@ -29,10 +43,70 @@ bool event_init()
         return false;
     }
 
+    memset(keypadOf, -1, sizeof(keypadOf));
+
+    for (int i = 0; i < 16; i++)
+        keypadOf[keyMap[i]] = i;
+
+    return true;
+}
+
+bool event_setKeyMap(const char *names)
+{
+    SDL_Scancode map[16];
+    int count = 0;
+    const char *end;
+
+    // Every name up to the last one, so a 17th one or a trailing comma don't go unnoticed
+    do
+    {
+        end = strchr(names, ',');
+
+        size_t length = end != NULL ? (size_t)(end - names) : strlen(names);
+        char name[32] = "";
+
+        if (count == 16)
+        {
+            fprintf(stderr, "Error: The key map requires 16 comma separated keys, from key 0 to key F.\n");
+            return false;
+        }
+
+        if (length < sizeof(name))
+            memcpy(name, names, length);
+
+        if ((map[count] = SDL_GetScancodeFromName(name)) == SDL_SCANCODE_UNKNOWN)
+        {
+            fprintf(stderr, "Error: Unknown key '%.*s' in the key map.\n", (int)length, names);
+            return false;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (map[i] == map[count])
+            {
+                fprintf(stderr, "Error: Key '%s' is mapped to both key %X and key %X.\n", name, i, count);
+                return false;
+            }
+        }
+
+        count++;
+
+        if (end != NULL)
+            names = end + 1;
+    } while (end != NULL);
+
+    if (count != 16)
+    {
+        fprintf(stderr, "Error: The key map requires 16 comma separated keys, from key 0 to key F.\n");
+        return false;
+    }
+
+    memcpy(keyMap, map, sizeof(keyMap));
+
     return true;
 }
 
-void event_update(bool keypad[16], bool *quit)
+void event_update(KeyQueue *queue, bool *rewind, bool *quit)
 {
     // Loop through SDL events
     while (SDL_PollEvent(&e))
@@ -42,17 +116,27 @@ void event_update(bool keypad[16], bool *quit)
 
         if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP)
         {
-            // Check if any of the known/mapped keycodes matches the one being pressed/release
-            for (int i = 0; i < 16; i++)
-            {
-                if (keyMap[i] == e.key.keysym.sym)
-                {
-                    // If it's a KEYDOWN event, stores true, otherwise, KEYUP is assumed and stores false
-                    keypad[i] = e.type == SDL_KEYDOWN;
-                }
-            }
+            // Rewinding lasts for as long as the key is held
+            if (e.key.keysym.sym == SDLK_BACKSPACE)
+                *rewind = e.type == SDL_KEYDOWN;
+
+            int key = keypadOf[e.key.keysym.scancode];
+
+            // Repeats of a held key don't change the keypad
+            if (key < 0 || ((keypad >> key) & 1) == (e.type == SDL_KEYDOWN))
+                continue;
+
+            keypad ^= 1 << key;
+
+            // Stamped as they're seen, each transition lands at its own point of the frame
+            if (!keyqueue_push(queue, pacer_now(), keypad))
+                keypadPending = true;
         }
     }
+
+    // Transitions left out only lose their timing, as the next one pushed carries the whole keypad
+    if (keypadPending)
+        keypadPending = !keyqueue_push(queue, pacer_now(), keypad);
 }
 
 void event_destroy()
@@ -0,0 +1,222 @@
+#include "../include/input.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+// Start of an input log file
+typedef struct
+{
+    uint32_t magic;   // CHIP8_INPUT_MAGIC
+    uint32_t version; // CHIP8_INPUT_VERSION
+    uint64_t seed;
+    uint64_t cycles;
+    uint64_t gfx[CHIP8_GFX_H];
+    int32_t processorFreq;
+    uint32_t costModel;
+    uint32_t shiftQuirk;
+    uint32_t count; // Events following the header
+} Header;
+
+_Static_assert(sizeof(Header) == offsetof(Header, count) + sizeof(uint32_t), "Header must not have any padding");
+
+void input_start(Chip8InputLog *log, const Chip8 *chip8, int processorFreq)
+{
+    log->processorFreq = processorFreq;
+    log->costModel = chip8->costModel;
+    log->shiftQuirk = chip8->shiftQuirk;
+    log->seed = chip8->rng;
+    log->cycles = 0;
+    memcpy(log->gfx, chip8->gfx, sizeof(log->gfx));
+
+    log->events = NULL;
+    log->count = 0;
+    log->capacity = 0;
+}
+
+bool input_record(Chip8InputLog *log, const Chip8 *chip8)
+{
+    uint16_t keys = 0;
+
+    for (int i = 0; i < 16; i++)
+        keys |= chip8->key[i] << i;
+
+    input_rewind(log, chip8);
+
+    // Every key starts released
+    if (keys == (log->count > 0 ? log->events[log->count - 1].keys : 0))
+        return true;
+
+    if (log->count == log->capacity)
+    {
+        unsigned int capacity = log->capacity > 0 ? log->capacity * 2 : 256;
+        Chip8KeypadEvent *events = realloc(log->events, capacity * sizeof(Chip8KeypadEvent));
+
+        if (events == NULL)
+            return false;
+
+        log->events = events;
+        log->capacity = capacity;
+    }
+
+    log->events[log->count++] = (Chip8KeypadEvent){.cycle = chip8->cycles, .keys = keys};
+
+    return true;
+}
+
+void input_rewind(Chip8InputLog *log, const Chip8 *chip8)
+{
+    while (log->count > 0 && log->events[log->count - 1].cycle >= chip8->cycles)
+        log->count--;
+}
+
+void input_finish(Chip8InputLog *log, const Chip8 *chip8)
+{
+    log->cycles = chip8->cycles;
+    memcpy(log->gfx, chip8->gfx, sizeof(log->gfx));
+}
+
+bool input_save(const Chip8InputLog *log, const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    Header header = {
+        .magic = CHIP8_INPUT_MAGIC,
+        .version = CHIP8_INPUT_VERSION,
+        .seed = log->seed,
+        .cycles = log->cycles,
+        .processorFreq = log->processorFreq,
+        .costModel = log->costModel,
+        .shiftQuirk = log->shiftQuirk,
+        .count = log->count,
+    };
+    unsigned long previous = 0;
+
+    if (fp == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    memcpy(header.gfx, log->gfx, sizeof(header.gfx));
+    fwrite(&header, sizeof(header), 1, fp);
+
+    for (unsigned int i = 0; i < log->count; i++)
+    {
+        unsigned long delta = log->events[i].cycle - previous;
+
+        // 7 bits at a time, lowest first, the highest bit telling whether more follow
+        do
+        {
+            putc((delta & 0x7F) | (delta > 0x7F ? 0x80 : 0), fp);
+            delta >>= 7;
+        } while (delta > 0);
+
+        putc(log->events[i].keys & 0xFF, fp);
+        putc(log->events[i].keys >> 8, fp);
+
+        previous = log->events[i].cycle;
+    }
+
+    // Errors are sticky, so a single check covers every write
+    bool failed = ferror(fp) != 0;
+
+    if (fclose(fp) != 0 || failed)
+    {
+        fprintf(stderr, "Failed to write the input log '%s'.\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+bool input_load(Chip8InputLog *log, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    Header header;
+    unsigned long cycle = 0;
+
+    if (fp == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != CHIP8_INPUT_MAGIC || header.version != CHIP8_INPUT_VERSION)
+    {
+        fprintf(stderr, "'%s' isn't an input log of this version of the emulator.\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    log->processorFreq = header.processorFreq;
+    log->costModel = header.costModel;
+    log->shiftQuirk = header.shiftQuirk;
+    log->seed = header.seed;
+    log->cycles = header.cycles;
+    memcpy(log->gfx, header.gfx, sizeof(log->gfx));
+
+    log->events = NULL;
+    log->count = 0;
+    log->capacity = 0;
+
+    // The array grows as events are read, rather than trusting the count of the header upfront
+    while (log->count < header.count)
+    {
+        unsigned long delta = 0;
+        int byte;
+        int shift = 0;
+
+        do
+        {
+            byte = getc(fp);
+            delta |= (unsigned long)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte != EOF && byte & 0x80 && shift < 64);
+
+        int low = getc(fp);
+        int high = getc(fp);
+
+        if (byte == EOF || low == EOF || high == EOF)
+            break;
+
+        if (log->count == log->capacity)
+        {
+            unsigned int capacity = log->capacity > 0 ? log->capacity * 2 : 256;
+            Chip8KeypadEvent *events = realloc(log->events, capacity * sizeof(Chip8KeypadEvent));
+
+            if (events == NULL)
+            {
+                fprintf(stderr, "Out of memory for the input log '%s'.\n", path);
+                fclose(fp);
+                input_free(log);
+                return false;
+            }
+
+            log->events = events;
+            log->capacity = capacity;
+        }
+
+        cycle += delta;
+        log->events[log->count++] = (Chip8KeypadEvent){.cycle = cycle, .keys = low | high << 8};
+    }
+
+    fclose(fp);
+
+    if (log->count < header.count)
+    {
+        fprintf(stderr, "The input log '%s' is truncated.\n", path);
+        input_free(log);
+        return false;
+    }
+
+    return true;
+}
+
+void input_free(Chip8InputLog *log)
+{
+    free(log->events);
+    log->events = NULL;
+    log->count = 0;
+    log->capacity = 0;
+}
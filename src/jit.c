@@ -0,0 +1,663 @@
+#include "../include/jit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) && defined(__unix__)
+#    define JIT_SUPPORTED
+#endif
+
+#ifndef JIT_SUPPORTED
+
+Chip8Jit *jit_create(Chip8 *chip8)
+{
+    (void)chip8;
+
+    return NULL;
+}
+
+Chip8StopReason jit_runFor(Chip8Jit *jit, double deltaTime, unsigned int maxCycles)
+{
+    (void)jit;
+    (void)deltaTime;
+    (void)maxCycles;
+
+    return CHIP8_STOP_ERROR;
+}
+
+void jit_flush(Chip8Jit *jit)
+{
+    (void)jit;
+}
+
+void jit_destroy(Chip8Jit *jit)
+{
+    (void)jit;
+}
+
+#else
+
+#include <sys/mman.h>
+
+// Executable memory for the translations. Everything is dropped once it's full
+#define ARENA_SIZE (1 << 20)
+
+// Max amount of instructions in a block, and the most bytes such a block can take
+#define MAX_BLOCK_LENGTH 64
+#define MAX_BLOCK_BYTES (MAX_BLOCK_LENGTH * 512)
+
+// Bytes written over this many translations are left to the interpreter from then on
+#define HOT_WRITE_HITS 2
+
+// Each block has at most 2 exits, and only one block starts at each address
+#define MAX_EXITS (4096 * 2)
+
+// Translation state of each address
+enum
+{
+    UNTRANSLATED,
+    TRANSLATED,
+    INTERPRET // The instruction at this address is left to the interpreter
+};
+
+// x86-64 registers, by their encoding
+enum
+{
+    AL = 0,
+    CL = 1
+};
+
+// Offsets of the Chip8 fields used by the native code, which gets the Chip8 address in rdi
+#define V_(x) ((int32_t)(offsetof(Chip8, V) + (x)))
+#define OFF_I ((int32_t)offsetof(Chip8, I))
+#define OFF_PC ((int32_t)offsetof(Chip8, PC))
+#define OFF_DT ((int32_t)offsetof(Chip8, dt))
+#define OFF_MEMORY ((int32_t)offsetof(Chip8, memory))
+#define OFF_KEY ((int32_t)offsetof(Chip8, key))
+
+// State shared with the native code, which gets its address in rsi
+typedef struct
+{
+    long fuel;  // Instructions the native code may still run
+    int exitId; // Exit taken to leave the native code, -1 when it bailed out or the exit is dynamic
+} JitRegs;
+
+typedef void (*JitBlock)(Chip8 *c, JitRegs *regs);
+
+// Static exit of a block: a jmp leaving to a stub until it gets linked to the target block
+typedef struct
+{
+    unsigned char *rel; // rel32 operand of the jmp
+    unsigned short target;
+    bool linked;
+} JitExit;
+
+struct Chip8Jit
+{
+    Chip8 *chip8;
+
+    unsigned char *arena;
+    size_t arenaUsed;
+
+    void *entry[4096];
+    unsigned char state[4096];
+    bool covered[4096]; // Byte read by a translation, so writing to it drops them all
+    unsigned char writeHits[4096]; // Times writing to the byte dropped the translations, kept across flushes
+
+    JitExit exits[MAX_EXITS];
+    int exitCount;
+
+    bool shiftQuirk; // Quirks are resolved while translating
+
+    unsigned long flushes;
+};
+
+static void emit8(Chip8Jit *jit, unsigned char byte)
+{
+    jit->arena[jit->arenaUsed++] = byte;
+}
+
+static void emit16(Chip8Jit *jit, uint16_t value)
+{
+    memcpy(jit->arena + jit->arenaUsed, &value, sizeof(value));
+    jit->arenaUsed += sizeof(value);
+}
+
+static void emit32(Chip8Jit *jit, int32_t value)
+{
+    memcpy(jit->arena + jit->arenaUsed, &value, sizeof(value));
+    jit->arenaUsed += sizeof(value);
+}
+
+// ModRM addressing [rdi + disp32], with the given register (or opcode extension) in the reg field
+static void emitRdi(Chip8Jit *jit, int reg, int32_t disp)
+{
+    emit8(jit, 0x87 | reg << 3);
+    emit32(jit, disp);
+}
+
+// Point a rel32 operand at the given code
+static void patchRel32(unsigned char *rel, const unsigned char *target)
+{
+    int32_t value = (int32_t)(target - (rel + 4));
+
+    memcpy(rel, &value, sizeof(value));
+}
+
+// jcc/jmp rel32 with a placeholder target. Return the address of the rel32 operand
+static unsigned char *emitJump(Chip8Jit *jit, unsigned char opcode)
+{
+    if (opcode == 0xE9)
+    {
+        emit8(jit, 0xE9); // jmp
+    }
+    else
+    {
+        emit8(jit, 0x0F); // jcc
+        emit8(jit, opcode);
+    }
+
+    emit32(jit, 0);
+
+    return jit->arena + jit->arenaUsed - 4;
+}
+
+// mov word [rdi + PC], target; jmp to a stub for now. Return the exit's index
+static int emitExit(Chip8Jit *jit, unsigned short target)
+{
+    JitExit *exit = &jit->exits[jit->exitCount];
+
+    emit8(jit, 0x66);
+    emit8(jit, 0xC7);
+    emitRdi(jit, 0, OFF_PC);
+    emit16(jit, target);
+
+    exit->rel = emitJump(jit, 0xE9);
+    exit->target = target;
+    exit->linked = false;
+
+    return jit->exitCount++;
+}
+
+// Stub leaving the native code through the given exit: mov dword [rsi + exitId], exit; ret
+static void emitExitStub(Chip8Jit *jit, int exit)
+{
+    patchRel32(jit->exits[exit].rel, jit->arena + jit->arenaUsed);
+
+    emit8(jit, 0xC7);
+    emit8(jit, 0x46);
+    emit8(jit, offsetof(JitRegs, exitId));
+    emit32(jit, exit);
+    emit8(jit, 0xC3);
+}
+
+// Two-way exit for skip instructions, whose flags are already set. noSkip is the jcc taken when not skipping
+static void emitSkip(Chip8Jit *jit, unsigned char noSkip, unsigned short address, int exits[2])
+{
+    unsigned char *rel = emitJump(jit, noSkip);
+
+    exits[0] = emitExit(jit, address + 4);
+    patchRel32(rel, jit->arena + jit->arenaUsed);
+    exits[1] = emitExit(jit, address + 2);
+}
+
+// Compare the key with the value of Vx against 0: movzx eax, byte [Vx]; and eax, 0xF; cmp byte [rdi + rax + key], 0
+static void emitKeyTest(Chip8Jit *jit, unsigned char x)
+{
+    emit8(jit, 0x0F);
+    emit8(jit, 0xB6);
+    emitRdi(jit, AL, V_(x));
+    emit8(jit, 0x25);
+    emit32(jit, 0xF);
+    emit8(jit, 0x80);
+    emit8(jit, 0xBC);
+    emit8(jit, 0x07);
+    emit32(jit, OFF_KEY);
+    emit8(jit, 0x00);
+}
+
+// Store al in Vx and cl in VF, in this order so VF wins when x is F
+static void emitStoreResult(Chip8Jit *jit, unsigned char x)
+{
+    emit8(jit, 0x88);
+    emitRdi(jit, AL, V_(x));
+    emit8(jit, 0x88);
+    emitRdi(jit, CL, V_(0xF));
+}
+
+/*
+ * Emit the instruction at the given address. Return 1 if it was emitted and the block
+ * goes on, 0 if it ended the block (filling the exits) or -1 if it can't be translated.
+ */
+static int emitInstruction(Chip8Jit *jit, unsigned short address, int exits[2])
+{
+    const Chip8 *c = jit->chip8;
+    unsigned short opCode = c->memory[address] << 8 | c->memory[address + 1];
+    unsigned char x = (opCode & 0x0F00) >> 8;
+    unsigned char y = (opCode & 0x00F0) >> 4;
+    unsigned char kk = opCode & 0x00FF;
+    unsigned short nnn = opCode & 0x0FFF;
+
+    switch (opCode >> 12)
+    {
+    case 0x1: // JP addr
+        exits[0] = emitExit(jit, nnn);
+        return 0;
+
+    case 0x3: // SE Vx, byte: cmp byte [Vx], kk
+    case 0x4: // SNE Vx, byte
+        emit8(jit, 0x80);
+        emitRdi(jit, 7, V_(x));
+        emit8(jit, kk);
+        emitSkip(jit, opCode >> 12 == 0x3 ? 0x85 : 0x84, address, exits);
+        return 0;
+
+    case 0x5: // SE Vx, Vy: mov al, [Vx]; cmp al, [Vy]
+    case 0x9: // SNE Vx, Vy
+        emit8(jit, 0x8A);
+        emitRdi(jit, AL, V_(x));
+        emit8(jit, 0x3A);
+        emitRdi(jit, AL, V_(y));
+        emitSkip(jit, opCode >> 12 == 0x5 ? 0x85 : 0x84, address, exits);
+        return 0;
+
+    case 0x6: // LD Vx, byte: mov byte [Vx], kk
+        emit8(jit, 0xC6);
+        emitRdi(jit, 0, V_(x));
+        emit8(jit, kk);
+        return 1;
+
+    case 0x7: // ADD Vx, byte: add byte [Vx], kk
+        emit8(jit, 0x80);
+        emitRdi(jit, 0, V_(x));
+        emit8(jit, kk);
+        return 1;
+
+    case 0x8:
+        switch (opCode & 0x000F)
+        {
+        case 0x0: // LD Vx, Vy: mov al, [Vy]; mov [Vx], al
+            emit8(jit, 0x8A);
+            emitRdi(jit, AL, V_(y));
+            emit8(jit, 0x88);
+            emitRdi(jit, AL, V_(x));
+            return 1;
+
+        case 0x1: // OR/AND/XOR Vx, Vy: mov al, [Vy]; op [Vx], al
+        case 0x2:
+        case 0x3:
+            emit8(jit, 0x8A);
+            emitRdi(jit, AL, V_(y));
+            emit8(jit, (opCode & 0x000F) == 0x1 ? 0x08 : (opCode & 0x000F) == 0x2 ? 0x20 : 0x30);
+            emitRdi(jit, AL, V_(x));
+            return 1;
+
+        case 0x4: // ADD Vx, Vy: mov al, [Vx]; add al, [Vy]; setc cl
+            emit8(jit, 0x8A);
+            emitRdi(jit, AL, V_(x));
+            emit8(jit, 0x02);
+            emitRdi(jit, AL, V_(y));
+            emit8(jit, 0x0F);
+            emit8(jit, 0x92);
+            emit8(jit, 0xC1);
+            emitStoreResult(jit, x);
+            return 1;
+
+        case 0x5: // SUB Vx, Vy: mov al, [Vx]; sub al, [Vy]; setnc cl
+        case 0x7: // SUBN Vx, Vy: mov al, [Vy]; sub al, [Vx]; setnc cl
+            emit8(jit, 0x8A);
+            emitRdi(jit, AL, V_((opCode & 0x000F) == 0x5 ? x : y));
+            emit8(jit, 0x2A);
+            emitRdi(jit, AL, V_((opCode & 0x000F) == 0x5 ? y : x));
+            emit8(jit, 0x0F);
+            emit8(jit, 0x93);
+            emit8(jit, 0xC1);
+            emitStoreResult(jit, x);
+            return 1;
+
+        case 0x6: // SHR Vx {, Vy}: mov al, [Vx or Vy]; mov cl, al; and cl, 1; shr al, 1
+            emit8(jit, 0x8A);
+            emitRdi(jit, AL, V_(jit->shiftQuirk ? x : y));
+            emit8(jit, 0x88);
+            emit8(jit, 0xC1);
+            emit8(jit, 0x80);
+            emit8(jit, 0xE1);
+            emit8(jit, 0x01);
+            emit8(jit, 0xD0);
+            emit8(jit, 0xE8);
+            emitStoreResult(jit, x);
+            return 1;
+
+        case 0xE: // SHL Vx {, Vy}: mov al, [Vx or Vy]; mov cl, al; shr cl, 7; add al, al
+            emit8(jit, 0x8A);
+            emitRdi(jit, AL, V_(jit->shiftQuirk ? x : y));
+            emit8(jit, 0x88);
+            emit8(jit, 0xC1);
+            emit8(jit, 0xC0);
+            emit8(jit, 0xE9);
+            emit8(jit, 0x07);
+            emit8(jit, 0x00);
+            emit8(jit, 0xC0);
+            emitStoreResult(jit, x);
+            return 1;
+        }
+        return -1;
+
+    case 0xA: // LD I, addr: mov word [I], nnn
+        emit8(jit, 0x66);
+        emit8(jit, 0xC7);
+        emitRdi(jit, 0, OFF_I);
+        emit16(jit, nnn);
+        return 1;
+
+    case 0xB: // JP V0, addr: movzx eax, byte [V0]; add eax, nnn; mov word [PC], ax; ret
+        emit8(jit, 0x0F);
+        emit8(jit, 0xB6);
+        emitRdi(jit, AL, V_(0));
+        emit8(jit, 0x05);
+        emit32(jit, nnn);
+        emit8(jit, 0x66);
+        emit8(jit, 0x89);
+        emitRdi(jit, AL, OFF_PC);
+        emit8(jit, 0xC3);
+        return 0;
+
+    case 0xE:
+        if (kk != 0x9E && kk != 0xA1)
+            return -1;
+
+        // SKP Vx skips when the key is pressed, SKNP Vx when it isn't
+        emitKeyTest(jit, x);
+        emitSkip(jit, kk == 0x9E ? 0x84 : 0x85, address, exits);
+        return 0;
+
+    case 0xF:
+        switch (kk)
+        {
+        case 0x07: // LD Vx, DT: mov al, [dt]; mov [Vx], al
+            emit8(jit, 0x8A);
+            emitRdi(jit, AL, OFF_DT);
+            emit8(jit, 0x88);
+            emitRdi(jit, AL, V_(x));
+            return 1;
+
+        case 0x15: // LD DT, Vx: mov al, [Vx]; mov [dt], al
+            emit8(jit, 0x8A);
+            emitRdi(jit, AL, V_(x));
+            emit8(jit, 0x88);
+            emitRdi(jit, AL, OFF_DT);
+            return 1;
+
+        case 0x1E: // ADD I, Vx: movzx eax, byte [Vx]; add word [I], ax
+            emit8(jit, 0x0F);
+            emit8(jit, 0xB6);
+            emitRdi(jit, AL, V_(x));
+            emit8(jit, 0x66);
+            emit8(jit, 0x01);
+            emitRdi(jit, AL, OFF_I);
+            return 1;
+
+        case 0x29: // LD F, Vx: movzx eax, byte [Vx]; lea eax, [rax + rax * 4]; mov word [I], ax
+            emit8(jit, 0x0F);
+            emit8(jit, 0xB6);
+            emitRdi(jit, AL, V_(x));
+            emit8(jit, 0x8D);
+            emit8(jit, 0x04);
+            emit8(jit, 0x80);
+            emit8(jit, 0x66);
+            emit8(jit, 0x89);
+            emitRdi(jit, AL, OFF_I);
+            return 1;
+
+        case 0x65: // LD Vx, [I]: for each register, V[i] = memory[(I + i) & 0xFFF]
+            for (int i = 0; i <= x; i++)
+            {
+                emit8(jit, 0x0F); // movzx eax, word [I]
+                emit8(jit, 0xB7);
+                emitRdi(jit, AL, OFF_I);
+                emit8(jit, 0x05); // add eax, i
+                emit32(jit, i);
+                emit8(jit, 0x25); // and eax, 0xFFF
+                emit32(jit, 0x0FFF);
+                emit8(jit, 0x8A); // mov cl, [rdi + rax + memory]
+                emit8(jit, 0x8C);
+                emit8(jit, 0x07);
+                emit32(jit, OFF_MEMORY);
+                emit8(jit, 0x88); // mov [Vi], cl
+                emitRdi(jit, CL, V_(i));
+            }
+            return 1;
+        }
+        return -1;
+    }
+
+    // CLS, RET, CALL, RND, DRW, Fx0A, Fx18, Fx33 and Fx55 are left to the interpreter
+    return -1;
+}
+
+static void jit_protect(Chip8Jit *jit, bool writable)
+{
+    mprotect(jit->arena, ARENA_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+}
+
+/*
+ * Translate the block starting at the given address, up to a jump, skip or instruction
+ * the interpreter has to run. Each entry first checks there's fuel for the whole block.
+ */
+static void jit_translate(Chip8Jit *jit, unsigned short start)
+{
+    int exits[2] = {-1, -1};
+    unsigned short address = start;
+    int length = 0;
+    int emitted = 1;
+
+    if (jit->arenaUsed + MAX_BLOCK_BYTES > ARENA_SIZE)
+        jit_flush(jit);
+
+    unsigned char *entry = jit->arena + jit->arenaUsed;
+
+    jit_protect(jit, true);
+
+    // cmp qword [rsi + fuel], length; jl bail; sub qword [rsi + fuel], length (length patched below)
+    emit8(jit, 0x48);
+    emit8(jit, 0x81);
+    emit8(jit, 0x3E);
+    emit32(jit, 0);
+    unsigned char *bail = emitJump(jit, 0x8C);
+    emit8(jit, 0x48);
+    emit8(jit, 0x81);
+    emit8(jit, 0x2E);
+    emit32(jit, 0);
+
+    while (emitted == 1)
+    {
+        // Instructions need both of their bytes inside the memory
+        if (length == MAX_BLOCK_LENGTH || address >= sizeof(jit->chip8->memory) - 1)
+        {
+            exits[0] = emitExit(jit, address);
+            break;
+        }
+
+        size_t mark = jit->arenaUsed;
+        int exitMark = jit->exitCount;
+
+        // Self-modifying code would otherwise keep dropping every translation
+        if (jit->writeHits[address] >= HOT_WRITE_HITS || jit->writeHits[address + 1] >= HOT_WRITE_HITS)
+            emitted = -1;
+        else
+            emitted = emitInstruction(jit, address, exits);
+
+        if (emitted == -1)
+        {
+            // Discard whatever was emitted and leave the rest to the interpreter
+            jit->arenaUsed = mark;
+            jit->exitCount = exitMark;
+
+            if (length > 0)
+                exits[0] = emitExit(jit, address);
+
+            break;
+        }
+
+        jit->covered[address] = true;
+        jit->covered[address + 1] = true;
+        address += 2;
+        length++;
+    }
+
+    if (length == 0)
+    {
+        // Not even the first instruction can be translated. The interpreter runs whatever
+        // gets written there, so this address doesn't need to be covered
+        jit->arenaUsed = entry - jit->arena;
+        jit->state[start] = INTERPRET;
+        jit_protect(jit, false);
+        return;
+    }
+
+    memcpy(entry + 3, &length, sizeof(int32_t));
+    memcpy(entry + 16, &length, sizeof(int32_t));
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (exits[i] >= 0)
+            emitExitStub(jit, exits[i]);
+    }
+
+    patchRel32(bail, jit->arena + jit->arenaUsed);
+    emit8(jit, 0xC3);
+
+    jit_protect(jit, false);
+
+    jit->entry[start] = entry;
+    jit->state[start] = TRANSLATED;
+}
+
+// Native entry of the block at the given address, or NULL if the interpreter must run it
+static void *jit_lookup(Chip8Jit *jit, unsigned short address)
+{
+    if (address >= sizeof(jit->chip8->memory) - 1)
+        return NULL;
+
+    if (jit->state[address] == UNTRANSLATED)
+        jit_translate(jit, address);
+
+    return jit->state[address] == TRANSLATED ? jit->entry[address] : NULL;
+}
+
+// Chain the exit straight into the block of its target, so the native code doesn't come back here
+static void jit_link(Chip8Jit *jit, int exitId)
+{
+    unsigned long flushes = jit->flushes;
+    JitExit *exit = &jit->exits[exitId];
+    void *target;
+
+    if (exit->linked)
+        return;
+
+    target = jit_lookup(jit, exit->target);
+
+    // Translating the target might have dropped every block, this exit included
+    if (target == NULL || jit->flushes != flushes)
+        return;
+
+    jit_protect(jit, true);
+    patchRel32(exit->rel, target);
+    jit_protect(jit, false);
+
+    exit->linked = true;
+}
+
+static unsigned long jit_run(void *backend, Chip8 *chip8, unsigned long fuel)
+{
+    Chip8Jit *jit = backend;
+    void *entry = jit_lookup(jit, chip8->PC);
+
+    if (entry == NULL)
+        return 0;
+
+    JitRegs regs = {.fuel = fuel, .exitId = -1};
+
+    ((JitBlock)entry)(chip8, &regs);
+
+    if (regs.exitId >= 0)
+        jit_link(jit, regs.exitId);
+
+    return fuel - regs.fuel;
+}
+
+// Writing over translated code drops every translation
+static void jit_invalidate(void *backend, unsigned short address, unsigned short length)
+{
+    Chip8Jit *jit = backend;
+    bool hit = false;
+
+    for (unsigned short i = 0; i < length; i++)
+    {
+        unsigned short written = (address + i) & 0x0FFF;
+
+        if (jit->covered[written])
+        {
+            hit = true;
+
+            if (jit->writeHits[written] < HOT_WRITE_HITS)
+                jit->writeHits[written]++;
+        }
+    }
+
+    if (hit)
+        jit_flush(jit);
+}
+
+Chip8StopReason jit_runFor(Chip8Jit *jit, double deltaTime, unsigned int maxCycles)
+{
+    if (jit->chip8->shiftQuirk != jit->shiftQuirk)
+    {
+        jit_flush(jit);
+        jit->shiftQuirk = jit->chip8->shiftQuirk;
+    }
+
+    return chip8_runNative(jit->chip8, deltaTime, maxCycles, jit_run, jit_invalidate, jit);
+}
+
+Chip8Jit *jit_create(Chip8 *chip8)
+{
+    Chip8Jit *jit = calloc(1, sizeof(Chip8Jit));
+
+    if (jit == NULL)
+        return NULL;
+
+    jit->arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (jit->arena == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to allocate executable memory for the JIT.\n");
+        free(jit);
+        return NULL;
+    }
+
+    jit->chip8 = chip8;
+    jit->shiftQuirk = chip8->shiftQuirk;
+
+    return jit;
+}
+
+void jit_flush(Chip8Jit *jit)
+{
+    memset(jit->state, UNTRANSLATED, sizeof(jit->state));
+    memset(jit->covered, false, sizeof(jit->covered));
+    jit->exitCount = 0;
+    jit->arenaUsed = 0;
+    jit->flushes++;
+}
+
+void jit_destroy(Chip8Jit *jit)
+{
+    munmap(jit->arena, ARENA_SIZE);
+    free(jit);
+}
+
+#endif
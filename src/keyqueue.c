@@ -0,0 +1,64 @@
+#include "../include/keyqueue.h"
+
+#include <stdio.h>
+
+void keyqueue_init(KeyQueue *queue)
+{
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->applied = 0;
+    queue->latencyMax = 0;
+    queue->latencySum = 0;
+}
+
+bool keyqueue_push(KeyQueue *queue, int64_t time, uint16_t keys)
+{
+    unsigned long head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    // The acquire keeps the slot from being overwritten before the consumer is done with it
+    if (head - atomic_load_explicit(&queue->tail, memory_order_acquire) == KEYQUEUE_SIZE)
+        return false;
+
+    KeyTransition *transition = &queue->transitions[head & (KEYQUEUE_SIZE - 1)];
+
+    transition->time = time;
+    transition->keys = keys;
+
+    // The release makes the transition visible to the consumer along with the head
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+const KeyTransition *keyqueue_peek(KeyQueue *queue)
+{
+    unsigned long tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&queue->head, memory_order_acquire))
+        return NULL;
+
+    return &queue->transitions[tail & (KEYQUEUE_SIZE - 1)];
+}
+
+void keyqueue_pop(KeyQueue *queue, int64_t now)
+{
+    unsigned long tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    int64_t latency = now - queue->transitions[tail & (KEYQUEUE_SIZE - 1)].time;
+
+    queue->applied++;
+    queue->latencySum += latency;
+
+    if (latency > queue->latencyMax)
+        queue->latencyMax = latency;
+
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+}
+
+void keyqueue_report(const KeyQueue *queue)
+{
+    if (queue->applied == 0)
+        return;
+
+    printf("\nInput: %lu key transitions, latency %.2fms mean, %.2fms max",
+           queue->applied, queue->latencySum / queue->applied / 1e6, queue->latencyMax / 1e6);
+}
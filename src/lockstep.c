@@ -0,0 +1,775 @@
+#include "../include/lockstep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__)) && !defined(CHIP8_NO_AVX2)
+#    define LOCKSTEP_AVX2
+#    include <immintrin.h>
+#endif
+
+#define MEMORY_SIZE 4096
+#define WIDTH CHIP8_LOCKSTEP_WIDTH
+
+#define ADDR(address) ((address) & 0x0FFF)
+
+// PC of the lanes that halted, which never agrees with a running lane
+#define HALTED 0xFFFF
+
+// PC of the lanes that halted on the instruction of the current step, still ticking along with it
+#define HALTING 0xFFFE
+
+struct Chip8Lockstep
+{
+    unsigned int lanes;
+    unsigned int capacity; // Lanes rounded up to a whole group, the extra ones running unseen
+    unsigned int running;  // Lanes below lanes that didn't halt
+    unsigned int halting;
+    bool vector;           // Whether the host has AVX2
+    bool shiftQuirk;
+
+    // Virtual time, shared by every lane while it runs
+    unsigned long cycles;
+    unsigned long timerCycles;
+    unsigned long timerPeriod;
+
+    // Memory every lane started with, the code of the pages a lane didn't write to
+    unsigned char image[MEMORY_SIZE];
+
+    // One entry per lane, of each register in turn for the arrays of registers
+    unsigned char *V;  // [16][capacity]
+    uint16_t *I;
+    uint16_t *PC;
+    unsigned char *SP;
+    unsigned char *dt;
+    unsigned char *st;
+    uint16_t *stack; // [16][capacity]
+    uint16_t *keys;
+    uint64_t *rng;
+
+    // Per lane, one after the other
+    uint64_t *gfx;           // [capacity][CHIP8_GFX_H], only ever drawn lane by lane
+    unsigned char *memory;   // [capacity][MEMORY_SIZE]
+    uint64_t *groupPages;    // Pages any lane of a group wrote to, one bit per CHIP8_PAGE_SIZE bytes
+    uint16_t *haltPC;        // PC a lane halted with
+    unsigned long *haltCycles;
+    unsigned long *haltTimerCycles;
+
+    unsigned long long vectorInstructions;
+    unsigned long long scalarInstructions;
+
+    // What the lanes were created from, for the fields they don't keep
+    Chip8 initial;
+};
+
+// Zeroed memory aligned for the vector loads
+static void *lockstep_alloc(size_t size)
+{
+    void *memory = aligned_alloc(32, (size + 31) & ~(size_t)31);
+
+    if (memory != NULL)
+        memset(memory, 0, size);
+
+    return memory;
+}
+
+Chip8Lockstep *lockstep_create(const Chip8 *chip8, unsigned int lanes)
+{
+    if (chip8->costModel != CHIP8_COST_FLAT || chip8->cycleFrequency == 0 || lanes == 0)
+    {
+        fprintf(stderr, "Error: Lockstep lanes need the flat timing at a restricted processor frequency.\n");
+        return NULL;
+    }
+
+    Chip8Lockstep *ls = calloc(1, sizeof(Chip8Lockstep));
+
+    if (ls == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate the lockstep lanes.\n");
+        return NULL;
+    }
+
+    size_t cap = (lanes + WIDTH - 1) / WIDTH * WIDTH;
+
+    ls->lanes = lanes;
+    ls->capacity = cap;
+    ls->running = lanes;
+    ls->shiftQuirk = chip8->shiftQuirk;
+    ls->cycles = chip8->cycles;
+    ls->timerCycles = chip8->timerCycles;
+    ls->timerPeriod = chip8->timerPeriod;
+    memcpy(ls->image, chip8->memory, sizeof(ls->image));
+    memcpy(&ls->initial, chip8, sizeof(Chip8));
+
+#ifdef LOCKSTEP_AVX2
+    ls->vector = __builtin_cpu_supports("avx2");
+#endif
+
+    ls->V = lockstep_alloc(16 * cap);
+    ls->I = lockstep_alloc(cap * sizeof(uint16_t));
+    ls->PC = lockstep_alloc(cap * sizeof(uint16_t));
+    ls->SP = lockstep_alloc(cap);
+    ls->dt = lockstep_alloc(cap);
+    ls->st = lockstep_alloc(cap);
+    ls->stack = lockstep_alloc(16 * cap * sizeof(uint16_t));
+    ls->gfx = lockstep_alloc(CHIP8_GFX_H * cap * sizeof(uint64_t));
+    ls->keys = lockstep_alloc(cap * sizeof(uint16_t));
+    ls->rng = lockstep_alloc(cap * sizeof(uint64_t));
+    ls->memory = lockstep_alloc(cap * MEMORY_SIZE);
+    ls->groupPages = lockstep_alloc(cap / WIDTH * sizeof(uint64_t));
+    ls->haltPC = lockstep_alloc(cap * sizeof(uint16_t));
+    ls->haltCycles = lockstep_alloc(cap * sizeof(unsigned long));
+    ls->haltTimerCycles = lockstep_alloc(cap * sizeof(unsigned long));
+
+    if (ls->V == NULL || ls->I == NULL || ls->PC == NULL || ls->SP == NULL || ls->dt == NULL || ls->st == NULL ||
+        ls->stack == NULL || ls->gfx == NULL || ls->keys == NULL || ls->rng == NULL || ls->memory == NULL ||
+        ls->groupPages == NULL || ls->haltPC == NULL || ls->haltCycles == NULL ||
+        ls->haltTimerCycles == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate the lockstep lanes.\n");
+        lockstep_destroy(ls);
+        return NULL;
+    }
+
+    uint16_t keys = 0;
+
+    for (int i = 0; i < 16; i++)
+        keys |= chip8->key[i] << i;
+
+    for (size_t lane = 0; lane < cap; lane++)
+    {
+        for (int r = 0; r < 16; r++)
+        {
+            ls->V[r * cap + lane] = chip8->V[r];
+            ls->stack[r * cap + lane] = chip8->stack[r];
+        }
+
+        for (int row = 0; row < CHIP8_GFX_H; row++)
+            ls->gfx[lane * CHIP8_GFX_H + row] = chip8->gfx[row];
+
+        ls->I[lane] = chip8->I;
+        ls->PC[lane] = chip8->PC;
+        ls->SP[lane] = chip8->SP;
+        ls->dt[lane] = chip8->dt;
+        ls->st[lane] = chip8->st;
+        ls->keys[lane] = keys;
+        ls->rng[lane] = chip8->rng;
+        memcpy(ls->memory + lane * MEMORY_SIZE, chip8->memory, MEMORY_SIZE);
+    }
+
+    return ls;
+}
+
+void lockstep_seed(Chip8Lockstep *ls, unsigned int lane, uint64_t seed)
+{
+    // xorshift never leaves 0, so it can't be a state
+    ls->rng[lane] = seed != 0 ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+void lockstep_setKeys(Chip8Lockstep *ls, unsigned int lane, uint16_t keys)
+{
+    ls->keys[lane] = keys;
+}
+
+bool lockstep_halted(const Chip8Lockstep *ls, unsigned int lane)
+{
+    return ls->PC[lane] == HALTED;
+}
+
+// Stop a lane on the instruction at pc, which ran when it got as far as its handler
+static void lockstep_halt(Chip8Lockstep *ls, unsigned int lane, uint16_t pc, bool ran)
+{
+    ls->haltPC[lane] = ran ? pc + 2 : pc;
+    ls->haltCycles[lane] = ls->cycles + ran;
+    ls->haltTimerCycles[lane] = ls->timerCycles;
+    ls->running -= lane < ls->lanes;
+
+    // A lane that ran its instruction still has its clock advanced by it
+    if (ran)
+    {
+        ls->PC[lane] = HALTING;
+        ls->halting++;
+    }
+    else
+    {
+        ls->PC[lane] = HALTED;
+    }
+}
+
+// Record a write to the memory of a lane, whose group then checks the code of that page lane by lane
+static inline void lockstep_wrote(Chip8Lockstep *ls, unsigned int lane, unsigned short address)
+{
+    ls->groupPages[lane / WIDTH] |= (uint64_t)1 << (address / CHIP8_PAGE_SIZE);
+}
+
+// Same generator as chip8_random()
+static inline unsigned char lockstep_random(Chip8Lockstep *ls, unsigned int lane)
+{
+    uint64_t x = ls->rng[lane];
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    ls->rng[lane] = x;
+
+    return (x * 0x2545F4914F6CDD1DULL) >> 56;
+}
+
+// Run the instruction at the PC of a single lane, exactly like the handlers of chip8.c
+static void lockstep_stepLane(Chip8Lockstep *ls, unsigned int lane)
+{
+    const size_t cap = ls->capacity;
+    unsigned short pc = ls->PC[lane];
+    unsigned char *memory = ls->memory + lane * MEMORY_SIZE;
+
+#define V(r) ls->V[(r) * cap + lane]
+
+    if (pc == HALTED)
+        return;
+
+    // The opCode at PC needs both of its bytes inside the memory
+    if (pc >= MEMORY_SIZE - 1)
+    {
+        lockstep_halt(ls, lane, pc, false);
+        return;
+    }
+
+    unsigned short opCode = memory[pc] << 8 | memory[pc + 1];
+    unsigned char x = (opCode & 0x0F00) >> 8;
+    unsigned char y = (opCode & 0x00F0) >> 4;
+    unsigned char kk = opCode & 0x00FF;
+    unsigned short nnn = opCode & 0x0FFF;
+    unsigned short next = pc + 2;
+    unsigned char Vf;
+    bool valid = true;
+
+    ls->scalarInstructions++;
+
+    switch (opCode >> 12)
+    {
+    case 0x0:
+        if (kk == 0xE0)
+        {
+            memset(ls->gfx + lane * CHIP8_GFX_H, 0, CHIP8_GFX_H * sizeof(uint64_t));
+        }
+        else if (kk == 0xEE && ls->SP[lane] > 0)
+        {
+            ls->SP[lane]--;
+            next = ls->stack[ls->SP[lane] * cap + lane] + 2;
+        }
+        else
+        {
+            valid = false;
+        }
+        break;
+
+    case 0x1:
+        next = nnn;
+        break;
+
+    case 0x2:
+        if (ls->SP[lane] >= 15)
+        {
+            valid = false;
+            break;
+        }
+
+        ls->stack[ls->SP[lane] * cap + lane] = pc;
+        ls->SP[lane]++;
+        next = nnn;
+        break;
+
+    case 0x3:
+        next += V(x) == kk ? 2 : 0;
+        break;
+
+    case 0x4:
+        next += V(x) != kk ? 2 : 0;
+        break;
+
+    case 0x5:
+        next += V(x) == V(y) ? 2 : 0;
+        break;
+
+    case 0x6:
+        V(x) = kk;
+        break;
+
+    case 0x7:
+        V(x) += kk;
+        break;
+
+    case 0x8:
+        switch (opCode & 0x000F)
+        {
+        case 0x0: V(x) = V(y); break;
+        case 0x1: V(x) |= V(y); break;
+        case 0x2: V(x) &= V(y); break;
+        case 0x3: V(x) ^= V(y); break;
+
+        case 0x4:
+            Vf = V(x) + V(y) > 0xFF;
+            V(x) += V(y);
+            V(0xF) = Vf;
+            break;
+
+        case 0x5:
+            Vf = V(x) >= V(y);
+            V(x) -= V(y);
+            V(0xF) = Vf;
+            break;
+
+        case 0x6:
+            if (!ls->shiftQuirk)
+                V(x) = V(y);
+
+            Vf = V(x) & 1;
+            V(x) >>= 1;
+            V(0xF) = Vf;
+            break;
+
+        case 0x7:
+            Vf = V(y) >= V(x);
+            V(x) = V(y) - V(x);
+            V(0xF) = Vf;
+            break;
+
+        case 0xE:
+            if (!ls->shiftQuirk)
+                V(x) = V(y);
+
+            Vf = V(x) >> 7;
+            V(x) <<= 1;
+            V(0xF) = Vf;
+            break;
+
+        default:
+            valid = false;
+        }
+        break;
+
+    case 0x9:
+        next += V(x) != V(y) ? 2 : 0;
+        break;
+
+    case 0xA:
+        ls->I[lane] = nnn;
+        break;
+
+    case 0xB:
+        next = V(0) + nnn;
+        break;
+
+    case 0xC:
+        V(x) = lockstep_random(ls, lane) & kk;
+        break;
+
+    case 0xD:
+    {
+        // Like chip8_drawSprite()
+        unsigned int shift = V(x) % CHIP8_GFX_W;
+        bool collision = false;
+
+        for (int line = 0; line < (opCode & 0xF); line++)
+        {
+            uint64_t sprite = (uint64_t)memory[ADDR(ls->I[lane] + line)] << (CHIP8_GFX_W - 8);
+
+            if (shift != 0)
+                sprite = sprite >> shift | sprite << (CHIP8_GFX_W - shift);
+
+            uint64_t *row = &ls->gfx[lane * CHIP8_GFX_H + (V(y) + line) % CHIP8_GFX_H];
+
+            collision |= (*row & sprite) != 0;
+            *row ^= sprite;
+        }
+
+        V(0xF) = collision;
+        break;
+    }
+
+    case 0xE:
+        if (kk == 0x9E)
+            next += ls->keys[lane] >> (V(x) & 0xF) & 1 ? 2 : 0;
+        else if (kk == 0xA1)
+            next += ls->keys[lane] >> (V(x) & 0xF) & 1 ? 0 : 2;
+        else
+            valid = false;
+        break;
+
+    case 0xF:
+        switch (kk)
+        {
+        case 0x07:
+            V(x) = ls->dt[lane];
+            break;
+
+        case 0x0A:
+            // The lowest pressed key, else the instruction runs again
+            if (ls->keys[lane] != 0)
+                V(x) = __builtin_ctz(ls->keys[lane]);
+            else
+                next = pc;
+            break;
+
+        case 0x15:
+            ls->dt[lane] = V(x);
+            break;
+
+        case 0x18:
+            ls->st[lane] = V(x);
+            break;
+
+        case 0x1E:
+            ls->I[lane] += V(x);
+            break;
+
+        case 0x29:
+            ls->I[lane] = V(x) * 5;
+            break;
+
+        case 0x33:
+            memory[ADDR(ls->I[lane])] = V(x) / 100;
+            memory[ADDR(ls->I[lane] + 1)] = (V(x) / 10) % 10;
+            memory[ADDR(ls->I[lane] + 2)] = V(x) % 10;
+
+            for (int i = 0; i < 3; i++)
+                lockstep_wrote(ls, lane, ADDR(ls->I[lane] + i));
+            break;
+
+        case 0x55:
+            for (int i = 0; i <= x; i++)
+            {
+                memory[ADDR(ls->I[lane] + i)] = V(i);
+                lockstep_wrote(ls, lane, ADDR(ls->I[lane] + i));
+            }
+            break;
+
+        case 0x65:
+            for (int i = 0; i <= x; i++)
+                V(i) = memory[ADDR(ls->I[lane] + i)];
+            break;
+
+        default:
+            valid = false;
+        }
+        break;
+    }
+
+#undef V
+
+    if (!valid)
+        lockstep_halt(ls, lane, pc, true);
+    else
+        ls->PC[lane] = next;
+}
+
+#ifdef LOCKSTEP_AVX2
+#    define LOAD(address) _mm256_load_si256((const __m256i *)(address))
+#    define STORE(address, value) _mm256_store_si256((__m256i *)(address), (value))
+
+// Move the 16-bit PCs of a group forward by 2, and by 2 more where the mask of its bytes is set
+__attribute__((target("avx2"))) static inline void lockstep_skip(uint16_t *PC, unsigned short pc, __m256i skip)
+{
+    __m256i two = _mm256_set1_epi16(2);
+    __m256i next = _mm256_set1_epi16(pc + 2);
+
+    STORE(PC, _mm256_add_epi16(next, _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_castsi256_si128(skip)), two)));
+    STORE(PC + 16, _mm256_add_epi16(next, _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_extracti128_si256(skip, 1)), two)));
+}
+
+/*
+ * Run the instruction at the PC of a whole group at once, when all of its lanes are at the
+ * same PC with the same opCode and the instruction only involves registers. Return false,
+ * leaving the lanes untouched, when they have to run one by one.
+ */
+__attribute__((target("avx2"))) static bool lockstep_stepGroup(Chip8Lockstep *ls, unsigned int base)
+{
+    const size_t cap = ls->capacity;
+    uint16_t *PC = ls->PC + base;
+    unsigned short pc = PC[0];
+
+    if (pc >= MEMORY_SIZE - 1)
+        return false;
+
+    __m256i same = _mm256_set1_epi16(pc);
+
+    if (_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi16(LOAD(PC), same), _mm256_cmpeq_epi16(LOAD(PC + 16), same))) != -1)
+        return false;
+
+    unsigned short opCode = ls->image[pc] << 8 | ls->image[pc + 1];
+    uint64_t pages = (uint64_t)1 << (pc / CHIP8_PAGE_SIZE) | (uint64_t)1 << ((pc + 1) / CHIP8_PAGE_SIZE);
+
+    // Lanes might have rewritten the code since it was loaded
+    if (ls->groupPages[base / WIDTH] & pages)
+    {
+        for (unsigned int lane = base; lane < base + WIDTH; lane++)
+        {
+            const unsigned char *memory = ls->memory + lane * MEMORY_SIZE;
+
+            if ((memory[pc] << 8 | memory[pc + 1]) != opCode)
+                return false;
+        }
+    }
+
+    unsigned char x = (opCode & 0x0F00) >> 8;
+    unsigned char y = (opCode & 0x00F0) >> 4;
+    unsigned char kk = opCode & 0x00FF;
+    unsigned short nnn = opCode & 0x0FFF;
+    unsigned char *Vx = ls->V + x * cap + base;
+    unsigned char *Vy = ls->V + y * cap + base;
+    unsigned char *Vf = ls->V + 0xF * cap + base;
+    uint16_t *I = ls->I + base;
+    const __m256i one = _mm256_set1_epi8(1);
+    __m256i a, b, flag;
+
+    switch (opCode >> 12)
+    {
+    case 0x1:
+        STORE(PC, _mm256_set1_epi16(nnn));
+        STORE(PC + 16, _mm256_set1_epi16(nnn));
+        goto ran;
+
+    case 0x3:
+        lockstep_skip(PC, pc, _mm256_cmpeq_epi8(LOAD(Vx), _mm256_set1_epi8(kk)));
+        goto ran;
+
+    case 0x4:
+        lockstep_skip(PC, pc, _mm256_xor_si256(_mm256_cmpeq_epi8(LOAD(Vx), _mm256_set1_epi8(kk)), _mm256_set1_epi8(-1)));
+        goto ran;
+
+    case 0x5:
+        lockstep_skip(PC, pc, _mm256_cmpeq_epi8(LOAD(Vx), LOAD(Vy)));
+        goto ran;
+
+    case 0x9:
+        lockstep_skip(PC, pc, _mm256_xor_si256(_mm256_cmpeq_epi8(LOAD(Vx), LOAD(Vy)), _mm256_set1_epi8(-1)));
+        goto ran;
+
+    case 0x6:
+        STORE(Vx, _mm256_set1_epi8(kk));
+        goto next;
+
+    case 0x7:
+        STORE(Vx, _mm256_add_epi8(LOAD(Vx), _mm256_set1_epi8(kk)));
+        goto next;
+
+    case 0x8:
+        a = LOAD(Vx);
+        b = LOAD(Vy);
+
+        switch (opCode & 0x000F)
+        {
+        case 0x0: STORE(Vx, b); goto next;
+        case 0x1: STORE(Vx, _mm256_or_si256(a, b)); goto next;
+        case 0x2: STORE(Vx, _mm256_and_si256(a, b)); goto next;
+        case 0x3: STORE(Vx, _mm256_xor_si256(a, b)); goto next;
+
+        case 0x4:
+            // Carry unless a <= ~b
+            b = _mm256_xor_si256(b, _mm256_set1_epi8(-1));
+            flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(a, b), a), one);
+            STORE(Vx, _mm256_sub_epi8(_mm256_sub_epi8(a, b), one)); // a + b, as b is ~b - 1 now
+            STORE(Vf, flag);
+            goto next;
+
+        case 0x5:
+            flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), one);
+            STORE(Vx, _mm256_sub_epi8(a, b));
+            STORE(Vf, flag);
+            goto next;
+
+        case 0x7:
+            flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b), one);
+            STORE(Vx, _mm256_sub_epi8(b, a));
+            STORE(Vf, flag);
+            goto next;
+
+        case 0x6:
+            a = ls->shiftQuirk ? a : b;
+            flag = _mm256_and_si256(a, one);
+            STORE(Vx, _mm256_and_si256(_mm256_srli_epi16(a, 1), _mm256_set1_epi8(0x7F)));
+            STORE(Vf, flag);
+            goto next;
+
+        case 0xE:
+            a = ls->shiftQuirk ? a : b;
+            flag = _mm256_and_si256(_mm256_srli_epi16(a, 7), one);
+            STORE(Vx, _mm256_add_epi8(a, a));
+            STORE(Vf, flag);
+            goto next;
+        }
+        return false;
+
+    case 0xA:
+        STORE(I, _mm256_set1_epi16(nnn));
+        STORE(I + 16, _mm256_set1_epi16(nnn));
+        goto next;
+
+    case 0xF:
+        a = LOAD(Vx);
+
+        switch (kk)
+        {
+        case 0x07:
+            STORE(Vx, LOAD(ls->dt + base));
+            goto next;
+
+        case 0x15:
+            STORE(ls->dt + base, a);
+            goto next;
+
+        case 0x18:
+            STORE(ls->st + base, a);
+            goto next;
+
+        case 0x1E:
+            STORE(I, _mm256_add_epi16(LOAD(I), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a))));
+            STORE(I + 16, _mm256_add_epi16(LOAD(I + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1))));
+            goto next;
+
+        case 0x29:
+            b = _mm256_set1_epi16(5);
+            STORE(I, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(a)), b));
+            STORE(I + 16, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1)), b));
+            goto next;
+        }
+        return false;
+    }
+
+    // Calls, draws, keys, random numbers and memory accesses
+    return false;
+
+next:
+    STORE(PC, _mm256_set1_epi16(pc + 2));
+    STORE(PC + 16, _mm256_set1_epi16(pc + 2));
+
+ran:
+    ls->vectorInstructions += WIDTH;
+    return true;
+}
+
+#    undef LOAD
+#    undef STORE
+#endif
+
+// Move the shared clock forward by the instruction every lane just ran, like chip8_advanceClock()
+static void lockstep_advanceClock(Chip8Lockstep *ls)
+{
+    ls->cycles++;
+    ls->timerCycles += CHIP8_FLAT_COST;
+
+    while (ls->timerCycles >= ls->timerPeriod)
+    {
+        ls->timerCycles -= ls->timerPeriod;
+
+        for (unsigned int lane = 0; lane < ls->capacity; lane++)
+        {
+            bool ticks = ls->PC[lane] != HALTED;
+
+            ls->dt[lane] -= ticks && ls->dt[lane] > 0;
+            ls->st[lane] -= ticks && ls->st[lane] > 0;
+        }
+    }
+
+    // Lanes that halted on this instruction stop along with it
+    if (ls->halting > 0)
+    {
+        for (unsigned int lane = 0; lane < ls->capacity; lane++)
+        {
+            if (ls->PC[lane] == HALTING)
+            {
+                ls->PC[lane] = HALTED;
+                ls->haltTimerCycles[lane] = ls->timerCycles;
+            }
+        }
+
+        ls->halting = 0;
+    }
+}
+
+unsigned int lockstep_run(Chip8Lockstep *ls, unsigned long cycles)
+{
+    for (unsigned long i = 0; i < cycles && ls->running > 0; i++)
+    {
+        for (unsigned int base = 0; base < ls->capacity; base += WIDTH)
+        {
+#ifdef LOCKSTEP_AVX2
+            if (ls->vector && lockstep_stepGroup(ls, base))
+                continue;
+#endif
+
+            for (unsigned int lane = base; lane < base + WIDTH; lane++)
+                lockstep_stepLane(ls, lane);
+        }
+
+        lockstep_advanceClock(ls);
+    }
+
+    return ls->running;
+}
+
+void lockstep_read(const Chip8Lockstep *ls, unsigned int lane, Chip8 *chip8)
+{
+    const size_t cap = ls->capacity;
+    bool halted = ls->PC[lane] == HALTED;
+    unsigned long cycles = halted ? ls->haltCycles[lane] : ls->cycles;
+    unsigned long ran = cycles - ls->initial.cycles;
+
+    memcpy(chip8, &ls->initial, sizeof(Chip8));
+    memcpy(chip8->memory, ls->memory + lane * MEMORY_SIZE, sizeof(chip8->memory));
+
+    for (int r = 0; r < 16; r++)
+    {
+        chip8->V[r] = ls->V[r * cap + lane];
+        chip8->stack[r] = ls->stack[r * cap + lane];
+    }
+
+    memcpy(chip8->gfx, ls->gfx + lane * CHIP8_GFX_H, sizeof(chip8->gfx));
+
+    for (int i = 0; i < 16; i++)
+        chip8->key[i] = ls->keys[lane] >> i & 1;
+
+    chip8->I = ls->I[lane];
+    chip8->PC = halted ? ls->haltPC[lane] : ls->PC[lane];
+    chip8->SP = ls->SP[lane];
+    chip8->dt = ls->dt[lane];
+    chip8->st = ls->st[lane];
+    chip8->rng = ls->rng[lane];
+    chip8->drawFlag = false;
+
+    chip8->cycles = cycles;
+    chip8->clock = ls->initial.clock + ran * CHIP8_FLAT_COST;
+    chip8->budget = ls->initial.budget - (long)(ran * CHIP8_FLAT_COST);
+    chip8->timerCycles = halted ? ls->haltTimerCycles[lane] : ls->timerCycles;
+
+    // Everything might differ from the decoded instructions and the display of the copy
+    chip8_invalidateCode(chip8, 0, sizeof(chip8->memory));
+    chip8->dirtyRows = UINT32_MAX;
+}
+
+void lockstep_counts(const Chip8Lockstep *ls, unsigned long long *vector, unsigned long long *scalar)
+{
+    *vector = ls->vectorInstructions;
+    *scalar = ls->scalarInstructions;
+}
+
+void lockstep_destroy(Chip8Lockstep *ls)
+{
+    free(ls->V);
+    free(ls->I);
+    free(ls->PC);
+    free(ls->SP);
+    free(ls->dt);
+    free(ls->st);
+    free(ls->stack);
+    free(ls->gfx);
+    free(ls->keys);
+    free(ls->rng);
+    free(ls->memory);
+    free(ls->groupPages);
+    free(ls->haltPC);
+    free(ls->haltCycles);
+    free(ls->haltTimerCycles);
+    free(ls);
+}
@@ -1,37 +1,125 @@
 #include <time.h>
 #include <limits.h>
 #include <math.h>
+#include <stdatomic.h>
 
 #include "../include/chip8.h"
 #include "../include/renderer.h"
 #include "../include/event.h"
 #include "../include/audio.h"
+#include "../include/jit.h"
+#include "../include/aot.h"
+#include "../include/rewind.h"
+#include "../include/input.h"
+#include "../include/trace.h"
+#include "../include/triplebuffer.h"
+#include "../include/keyqueue.h"
+#include "../include/pacer.h"
 
 #include <SDL2/SDL.h>
 
+// Max amount of instructions executed per frame, the only limit at an unrestricted frequency
+#define SLICE_MAX_CYCLES 10000
+
+// The emulation runs a frame worth of instructions at a time and then sleeps until the next one
+#define FRAME_RATE 60
+
+// The display is presented at most once per 60Hz tick, whatever the amount of draws in between
+#define PRESENT_TIMESTEP (1.0 / 60.0)
+
+// A snapshot is taken on each present tick, so rewinding goes back in time at the same pace
+#define REWIND_SNAPSHOTS_PER_SECOND 60
+
+// Most frames --run-ahead can emulate past the present one on each tick
+#define RUN_AHEAD_MAX_FRAMES 8
+
+// State shared by the emulation thread and the main thread, which owns every SDL subsystem
+typedef struct
+{
+    Chip8 chip8;
+    Chip8Jit *jit;
+    Chip8Aot *aot;
+    Chip8Rewind *rewind; // NULL when disabled
+    Chip8InputLog *record; // Input of the session, NULL when not recording
+    bool presentOnCls; // Present the complete frame that was on the display before a CLS
+    unsigned int runAhead; // Frames emulated past the present one and shown instead, 0 when disabled
+    Chip8 snapshot;        // Machine the frames ahead roll back to
+
+    TripleBuffer frames;  // Frames published by the emulation thread, for the main thread to present
+    KeyQueue keys;        // Keypad transitions, pushed by the main thread as they happen
+    uint16_t keypad;      // Keys held as of the latest transition applied
+    atomic_bool sounding; // Whether the sound timer is running, read by the audio callback
+    atomic_bool rewinding; // Whether the rewind key is held
+    atomic_bool quit;     // Set by either thread to stop both
+
+    Pacer pacer; // Owned by the emulation thread until it's done
+} Session;
+
+// Display as the program drew it since the latest present tick
+typedef struct
+{
+    bool dirty;                  // The display changed since the latest present
+    bool clsReady;               // cls holds a complete frame still to be presented
+    uint64_t drawn[CHIP8_GFX_H]; // Display as of the latest draw
+    uint64_t cls[CHIP8_GFX_H];   // Display right before the latest CLS
+} Presentation;
+
 // Extract the RGB values from a string that follows the format "#RRGGBB"
 bool parseRGB(const char *str, unsigned char channel[3]);
 
+// Run the emulation and publish its frames until a quit is requested or the machine halts
+int emulationLoop(void *data);
+#ifdef CHIP8_PROFILE
+void writeProfile(const Chip8Profile *profile, const char *name, const char *prefix);
+#endif
+
+// Run a timeslice on the core selected for the session
+Chip8StopReason runSlice(Session *session, double deltaTime, unsigned int maxCycles);
+
+// Run a frame worth of timeslices, keeping track of what it drew
+Chip8StopReason runFrame(Session *session, double deltaTime, Presentation *presentation);
+
+// Set the keypad to the given transition, popping it, and log it. Return false when out of memory for the input log
+bool applyKeys(Session *session, const KeyTransition *transition);
+
+/*
+ * Emulate the frames of session->runAhead past the present one with the keys held now,
+ * write the display they end on and roll the machine back, so input shows up that much
+ * sooner than the program itself would show it.
+ */
+void runAhead(Session *session, uint64_t frame[CHIP8_GFX_H]);
+
 int main(int argc, char *argv[])
 {
     // DIR is a required argument
     if (argc < 2)
     {
-        fprintf(stderr, "Usage: %s DIR [--freq <int>] [--sound <double>] [--bg \"#RRGGBB\"] [--fg \"#RRGGBB\"]\n", argv[0]);
+        fprintf(stderr, "Usage: %s DIR [--freq <int>] [--sound <double>] [--bg \"#RRGGBB\"] [--fg \"#RRGGBB\"] [--core <interpreter|threaded|jit>] [--aot <file.so>] [--present <tick|cls>] [--timing <flat|vip>] [--rewind <seconds>] [--seed <int>] [--record <file>] [--trace <file>] [--run-ahead <frames>] [--keymap <keys>]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    clock_t time = clock();
-    double deltaTime = 0;
-
     bool halt_execution = false;
+    bool rewinding = false;
 
-    Chip8 chip8;
+    static Session session;
+    Chip8 *chip8 = &session.chip8;
     char *romDir = NULL;
     int processor_freq = 700;
     double sound_freq = 264;
     unsigned char bg_colour[3] = {0, 0, 0};
     unsigned char fg_colour[3] = {255, 255, 255};
+    Chip8Core core = CHIP8_CORE_INTERPRETER;
+    bool useJit = false;
+    char *aotPath = NULL;
+    Chip8CostModel costModel = CHIP8_COST_FLAT;
+    int rewindSeconds = 10;
+    uint64_t seed = 0;
+    char *recordPath = NULL;
+    static Chip8InputLog record;
+    char *tracePath = NULL;
+#ifdef CHIP8_PROFILE
+    char *profilePrefix = NULL;
+#endif
 
     // Arguments validation
     for (int i = 1; i < argc; i++)
@@ -117,6 +205,207 @@ int main(int argc, char *argv[])
             exit(EXIT_FAILURE);
         }
 
+        // [--core <interpreter|threaded|jit>]
+        if (strcmp(argv[i], "--core") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                if (strcmp(argv[i + 1], "interpreter") == 0 || strcmp(argv[i + 1], "threaded") == 0 || strcmp(argv[i + 1], "jit") == 0)
+                {
+                    core = strcmp(argv[i + 1], "threaded") == 0 ? CHIP8_CORE_THREADED : CHIP8_CORE_INTERPRETER;
+                    useJit = strcmp(argv[i + 1], "jit") == 0;
+                    i++; // Skip the next argument
+                    continue;
+                }
+            }
+
+            // Error if the requeriments weren't met
+            fprintf(stderr, "Error: --core requires 'interpreter', 'threaded' or 'jit'.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // [--aot <file.so>]
+        if (strcmp(argv[i], "--aot") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                aotPath = argv[i + 1];
+                i++; // Skip the next argument
+                continue;
+            }
+
+            // Error if the requeriments weren't met
+            fprintf(stderr, "Error: --aot requires the rom compiled by chip8-aot.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // [--present <tick|cls>]
+        if (strcmp(argv[i], "--present") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                if (strcmp(argv[i + 1], "tick") == 0 || strcmp(argv[i + 1], "cls") == 0)
+                {
+                    session.presentOnCls = strcmp(argv[i + 1], "cls") == 0;
+                    i++; // Skip the next argument
+                    continue;
+                }
+            }
+
+            // Error if the requeriments weren't met
+            fprintf(stderr, "Error: --present requires 'tick' or 'cls'.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // [--timing <flat|vip>]
+        if (strcmp(argv[i], "--timing") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                if (strcmp(argv[i + 1], "flat") == 0 || strcmp(argv[i + 1], "vip") == 0)
+                {
+                    costModel = strcmp(argv[i + 1], "vip") == 0 ? CHIP8_COST_VIP : CHIP8_COST_FLAT;
+                    i++; // Skip the next argument
+                    continue;
+                }
+            }
+
+            // Error if the requeriments weren't met
+            fprintf(stderr, "Error: --timing requires 'flat' or 'vip'.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // [--rewind <seconds>]
+        if (strcmp(argv[i], "--rewind") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                char *endptr;
+                long seconds = strtol(argv[i + 1], &endptr, 10);
+
+                // 0 disables rewinding altogether
+                if (*endptr == '\0' && endptr != argv[i + 1] && seconds >= 0 && seconds <= 3600)
+                {
+                    rewindSeconds = seconds;
+                    i++; // Skip the next argument
+                    continue;
+                }
+            }
+
+            // Error if the requeriments weren't met
+            fprintf(stderr, "Error: --rewind requires the seconds of history to keep, from 0 to 3600.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // [--seed <int>]
+        if (strcmp(argv[i], "--seed") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                char *endptr;
+
+                seed = strtoull(argv[i + 1], &endptr, 0);
+
+                if (*endptr == '\0' && endptr != argv[i + 1])
+                {
+                    i++; // Skip the next argument
+                    continue;
+                }
+            }
+
+            // Error if the requeriments weren't met
+            fprintf(stderr, "Error: --seed requires an unsigned integer value.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // [--record <file>]
+        if (strcmp(argv[i], "--record") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                recordPath = argv[i + 1];
+                i++; // Skip the next argument
+                continue;
+            }
+
+            // Error if the requeriments weren't met
+            fprintf(stderr, "Error: --record requires the file to write the input log to.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // [--trace <file>]
+        if (strcmp(argv[i], "--trace") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                tracePath = argv[i + 1];
+                i++; // Skip the next argument
+                continue;
+            }
+
+            // Error if the requeriments weren't met
+            fprintf(stderr, "Error: --trace requires the file to stream the trace to.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // [--run-ahead <frames>]
+        if (strcmp(argv[i], "--run-ahead") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                char *endptr;
+                long frames = strtol(argv[i + 1], &endptr, 10);
+
+                // 0 disables it
+                if (*endptr == '\0' && endptr != argv[i + 1] && frames >= 0 && frames <= RUN_AHEAD_MAX_FRAMES)
+                {
+                    session.runAhead = frames;
+                    i++; // Skip the next argument
+                    continue;
+                }
+            }
+
+            // Error if the requeriments weren't met
+            fprintf(stderr, "Error: --run-ahead requires the frames to run ahead, from 0 to %d.\n", RUN_AHEAD_MAX_FRAMES);
+            exit(EXIT_FAILURE);
+        }
+
+        // [--keymap <keys>]
+        if (strcmp(argv[i], "--keymap") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                if (event_setKeyMap(argv[i + 1]))
+                {
+                    i++; // Skip the next argument
+                    continue;
+                }
+
+                exit(EXIT_FAILURE);
+            }
+
+            // Error if the requeriments weren't met
+            fprintf(stderr, "Error: --keymap requires the 16 comma separated keys of the keypad, from key 0 to key F.\n");
+            exit(EXIT_FAILURE);
+        }
+
+#ifdef CHIP8_PROFILE
+        // [--profile <prefix>]
+        if (strcmp(argv[i], "--profile") == 0)
+        {
+            if (i + 1 < argc)
+            {
+                profilePrefix = argv[i + 1];
+                i++; // Skip the next argument
+                continue;
+            }
+
+            // Error if the requeriments weren't met
+            fprintf(stderr, "Error: --profile requires the prefix of the files to write the profile to.\n");
+            exit(EXIT_FAILURE);
+        }
+#endif
+
         // Handle rom directory
         if (romDir != NULL)
         {
@@ -134,54 +423,433 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
-    chip8_init(&chip8, processor_freq);
+    chip8_init(chip8, processor_freq);
+    chip8_setCostModel(chip8, costModel);
+    chip8_seed(chip8, seed);
+    chip8->core = core;
+
+    // With an unrestricted processor frequency, dt and st follow the host's time, which a replay can't
+    if (recordPath != NULL && processor_freq <= 0)
+    {
+        fprintf(stderr, "Error: --record requires a restricted processor frequency.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (processor_freq <= 0)
+    {
+        printf("Starting Chip-8 at an unrestricted frequency.\n");
+    }
+    else if (costModel == CHIP8_COST_VIP)
+    {
+        printf("Starting Chip-8 at the COSMAC VIP timings.\n");
+    }
+    else
+    {
+        printf("Starting Chip-8 at %uHz.\n", processor_freq);
+    }
+
+    printf("Loading file '%s'\n", romDir);
+
+    // Try to load rom: exit on failure
+    if (!chip8_loadGame(chip8, romDir))
+        exit(EXIT_FAILURE);
+
+    printf("File loaded successfully.\n");
+
+    if (recordPath != NULL)
+    {
+        input_start(&record, chip8, processor_freq);
+        session.record = &record;
+    }
+
+    // A rom compiled ahead of time takes over the selected core
+    if (aotPath != NULL)
+    {
+        session.aot = aot_load(chip8, aotPath);
+
+        if (session.aot == NULL)
+            printf("The compiled rom couldn't be loaded, using the selected core instead.\n");
+    }
+
+    // The JIT falls back to the interpreter on unsupported hosts
+    if (useJit && session.aot == NULL)
+    {
+        session.jit = jit_create(chip8);
+
+        if (session.jit == NULL)
+            printf("The JIT isn't available on this host, using the interpreter instead.\n");
+    }
+
+    // Every instruction then goes through the interpreter, the JIT and AOT included
+    if (tracePath != NULL && (chip8->trace = trace_create(CHIP8_TRACE_CAPACITY, tracePath)) == NULL)
+        exit(EXIT_FAILURE);
+
+    if (rewindSeconds > 0)
+    {
+        session.rewind = rewind_create(chip8, rewindSeconds * REWIND_SNAPSHOTS_PER_SECOND);
+
+        if (session.rewind == NULL)
+            printf("Not enough memory to rewind, going on without it.\n");
+    }
+
+    // Try to initialize subsystems: exit on failure
+    if (!gfx_init(CHIP8_GFX_W, CHIP8_GFX_H, bg_colour, fg_colour) || !event_init() || !audio_init(sound_freq, &session.sounding))
+        exit(EXIT_FAILURE);
+
+    triplebuffer_init(&session.frames);
+    keyqueue_init(&session.keys);
+
+    SDL_Thread *emulation = SDL_CreateThread(emulationLoop, "emulation", &session);
 
-    // Try to load rom and initialize subsystems: exit on failure
-    if (!chip8_loadGame(&chip8, romDir) || !gfx_init(CHIP8_GFX_W, CHIP8_GFX_H, bg_colour, fg_colour) || !event_init() || !audio_init(sound_freq))
+    if (emulation == NULL)
+    {
+        fprintf(stderr, "Error: Failed to start the emulation thread. %s\n", SDL_GetError());
         exit(EXIT_FAILURE);
+    }
 
-    // Emulation loop
-    while (true)
+    // Events and presentation, so a slow present never holds up the emulation
+    while (!atomic_load(&session.quit))
     {
-        event_update(chip8.key, &halt_execution);
+        event_update(&session.keys, &rewinding, &halt_execution);
 
-        // Clean up initialized subsystems on a quit event
         if (halt_execution)
         {
-            printf("\nHalting execution");
+            atomic_store(&session.quit, true);
+            break;
+        }
 
-            gfx_destroy();
-            event_destroy();
-            audio_destroy();
+        atomic_store(&session.rewinding, rewinding);
 
-            printf("\nBye bye!\n");
-            exit(EXIT_SUCCESS);
+        if (triplebuffer_acquire(&session.frames))
+        {
+            gfx_draw(triplebuffer_front(&session.frames));
+        }
+        else
+        {
+            SDL_Delay(1); // Nothing new to present yet
         }
+    }
+
+    SDL_WaitThread(emulation, NULL);
+
+    // Clean up initialized subsystems on a quit event or a halted machine
+    printf("\nHalting execution");
+
+    if (chip8->cycleFrequency > 0)
+        pacer_report(&session.pacer);
+
+    keyqueue_report(&session.keys);
 
-        // Update at what time the cycle is being executed and how much has passed since last cycle (s)
-        deltaTime = (double)(clock() - time) / CLOCKS_PER_SEC;
-        time = clock();
-        halt_execution = !chip8_emulateCycle(&chip8, deltaTime);
+    if (session.record != NULL)
+    {
+        input_finish(session.record, chip8);
+
+        if (input_save(session.record, recordPath))
+            printf("\nInput of %lu instructions recorded to '%s'", session.record->cycles, recordPath);
+
+        input_free(session.record);
+    }
+
+#ifdef CHIP8_PROFILE
+    if (profilePrefix != NULL)
+        writeProfile(&chip8->profile, romDir, profilePrefix);
+#endif
+
+    gfx_destroy();
+    event_destroy();
+    audio_destroy();
+
+    if (session.jit != NULL)
+        jit_destroy(session.jit);
+
+    if (session.aot != NULL)
+        aot_destroy(session.aot);
+
+    if (session.rewind != NULL)
+        rewind_destroy(session.rewind);
+
+    if (chip8->trace != NULL)
+    {
+        trace_destroy(chip8->trace);
+        printf("\nTrace written to '%s'", tracePath);
+    }
+
+    printf("\nBye bye!\n");
+    exit(EXIT_SUCCESS);
+}
+
+int emulationLoop(void *data)
+{
+    Session *session = (Session *)data;
+    Chip8 *chip8 = &session->chip8;
+    Chip8StopReason reason;
+    bool timed = chip8->cycleFrequency > 0;
+    double deltaTime = 0;
+
+    // Presentation
+    double tPresent = 0; // Time passed since the latest present tick
+    Presentation presentation = {.dirty = false, .clsReady = false};
+    uint64_t aheadFrame[CHIP8_GFX_H]; // Display the frames ahead ended on
+    uint64_t presented[CHIP8_GFX_H];  // Latest frame published
+
+    memcpy(presentation.drawn, chip8->gfx, sizeof(presentation.drawn));
+    memcpy(presented, chip8->gfx, sizeof(presented));
+
+    pacer_init(&session->pacer, FRAME_RATE);
 
-        if (chip8.PC >= sizeof(chip8.memory))
+    while (!atomic_load(&session->quit))
+    {
+        const KeyTransition *transition;
+
+        // Step back one snapshot per frame while the rewind key is held, whatever the processor frequency
+        if (session->rewind != NULL && atomic_load(&session->rewinding))
         {
-            fprintf(stderr, "Error: PC exceeded the memory limits.");
-            halt_execution = true;
+            pacer_wait(&session->pacer);
+
+            if (rewind_pop(session->rewind))
+            {
+                // The restored memory might not hold the code that was translated anymore
+                if (session->jit != NULL)
+                    jit_flush(session->jit);
+
+                if (session->aot != NULL)
+                    aot_refresh(session->aot);
+
+                memcpy(presentation.drawn, chip8->gfx, sizeof(presentation.drawn));
+                memcpy(presented, chip8->gfx, sizeof(presented));
+                memcpy(triplebuffer_back(&session->frames), chip8->gfx, sizeof(chip8->gfx));
+                triplebuffer_publish(&session->frames);
+                presentation.dirty = false;
+                presentation.clsReady = false;
+
+                // The snapshot holds the keys of its own time, the program goes on with those held now
+                for (int i = 0; i < 16; i++)
+                    chip8->key[i] = (session->keypad >> i) & 1;
+
+                // The log goes back along, even when no key changes from then on
+                if (session->record != NULL)
+                {
+                    input_rewind(session->record, chip8);
+
+                    if (!input_record(session->record, chip8))
+                    {
+                        fprintf(stderr, "Error: Out of memory for the input log.\n");
+                        atomic_store(&session->quit, true);
+                        continue;
+                    }
+                }
+            }
+
+            // The keypad the program goes on with once the rewind key is released
+            while ((transition = keyqueue_peek(&session->keys)) != NULL)
+            {
+                if (!applyKeys(session, transition))
+                    break;
+            }
+
+            atomic_store(&session->sounding, false);
             continue;
         }
 
-        if (chip8.st > 0)
+        // An unrestricted processor never sleeps, it runs as many instructions as it can
+        int64_t frameStart = session->pacer.latest;
+
+        deltaTime = timed ? pacer_wait(&session->pacer) : pacer_elapsed(&session->pacer);
+
+        int64_t frameEnd = session->pacer.latest;
+        double ran = 0; // Part of deltaTime run so far
+
+        /*
+         * Transitions seen during the previous frame land at the same point of this one, so
+         * the program sees them as far apart as they were typed and an Fx0A waiting for a key
+         * ends right there. Without a restricted processor frequency there is no such point,
+         * and they all apply upfront.
+         */
+        reason = CHIP8_STOP_BUDGET;
+
+        while (reason != CHIP8_STOP_ERROR && (transition = keyqueue_peek(&session->keys)) != NULL && transition->time <= frameEnd)
         {
-            audio_play();
+            double at = timed && transition->time > frameStart ? deltaTime * (transition->time - frameStart) / (frameEnd - frameStart) : 0;
+
+            if (at > ran)
+            {
+                reason = runFrame(session, at - ran, &presentation);
+                ran = at;
+            }
+
+            if (reason != CHIP8_STOP_ERROR && !applyKeys(session, transition))
+                break;
         }
-        else
+
+        if (reason != CHIP8_STOP_ERROR && !atomic_load(&session->quit))
+            reason = runFrame(session, deltaTime - ran, &presentation);
+
+        if (reason == CHIP8_STOP_ERROR)
+        {
+            atomic_store(&session->quit, true);
+            break;
+        }
+
+        atomic_store(&session->sounding, chip8->st > 0);
+
+        // Publish whatever the display became on each tick, coalescing every draw in between
+        tPresent += deltaTime;
+
+        if (tPresent >= PRESENT_TIMESTEP)
+        {
+            // Ticks missed by a slow iteration are dropped, rather than published back to back
+            tPresent = tPresent - PRESENT_TIMESTEP >= PRESENT_TIMESTEP ? 0 : tPresent - PRESENT_TIMESTEP;
+
+            if (session->rewind != NULL)
+                rewind_push(session->rewind);
+
+            if (session->runAhead > 0)
+            {
+                // The frame ahead replaces the present one, whether the present one drew or not
+                runAhead(session, aheadFrame);
+                presentation.dirty = memcmp(aheadFrame, presented, sizeof(presented)) != 0;
+                presentation.clsReady = false;
+
+                if (presentation.dirty)
+                {
+                    memcpy(presented, aheadFrame, sizeof(presented));
+                    memcpy(triplebuffer_back(&session->frames), aheadFrame, sizeof(aheadFrame));
+                    triplebuffer_publish(&session->frames);
+                    presentation.dirty = false;
+                }
+            }
+            else if (presentation.clsReady)
+            {
+                // What's been drawn since the CLS is still to be published
+                memcpy(triplebuffer_back(&session->frames), presentation.cls, sizeof(presentation.cls));
+                triplebuffer_publish(&session->frames);
+                presentation.clsReady = false;
+            }
+            else if (presentation.dirty)
+            {
+                memcpy(triplebuffer_back(&session->frames), chip8->gfx, sizeof(chip8->gfx));
+                triplebuffer_publish(&session->frames);
+                presentation.dirty = false;
+            }
+        }
+    }
+
+    return 0;
+}
+
+Chip8StopReason runFrame(Session *session, double deltaTime, Presentation *presentation)
+{
+    Chip8 *chip8 = &session->chip8;
+    unsigned long start = chip8->cycles;
+    Chip8StopReason reason = runSlice(session, deltaTime, SLICE_MAX_CYCLES);
+
+    // Go through the whole frame, handling every early stop on the way
+    while (reason != CHIP8_STOP_ERROR)
+    {
+        if (chip8->drawFlag)
         {
-            audio_stop();
+            presentation->dirty = true;
+
+            /*
+             * Both 00E0 and Dxyn leave PC on the next instruction. Games clearing the display
+             * on every frame had their previous frame complete right before the CLS.
+             */
+            unsigned short pc = chip8->PC - 2;
+
+            if (session->presentOnCls && chip8->memory[pc & 0x0FFF] == 0x00 && chip8->memory[(pc + 1) & 0x0FFF] == 0xE0)
+            {
+                memcpy(presentation->cls, presentation->drawn, sizeof(presentation->cls));
+                presentation->clsReady = true;
+            }
+
+            memcpy(presentation->drawn, chip8->gfx, sizeof(presentation->drawn));
         }
 
-        if (chip8.drawFlag)
-            gfx_draw(chip8.gfx);
+        if (reason == CHIP8_STOP_BUDGET || chip8->cycles - start >= SLICE_MAX_CYCLES)
+            break;
+
+        reason = runSlice(session, 0, SLICE_MAX_CYCLES - (chip8->cycles - start));
+    }
+
+    return reason;
+}
+
+bool applyKeys(Session *session, const KeyTransition *transition)
+{
+    Chip8 *chip8 = &session->chip8;
+
+    for (int i = 0; i < 16; i++)
+        chip8->key[i] = (transition->keys >> i) & 1;
+
+    session->keypad = transition->keys;
+    keyqueue_pop(&session->keys, pacer_now());
+
+    if (session->record != NULL && !input_record(session->record, chip8))
+    {
+        fprintf(stderr, "Error: Out of memory for the input log.\n");
+        atomic_store(&session->quit, true);
+        return false;
+    }
+
+    return true;
+}
+
+void runAhead(Session *session, uint64_t frame[CHIP8_GFX_H])
+{
+    Chip8 *chip8 = &session->chip8;
+    Chip8 *snapshot = &session->snapshot;
+    Presentation presentation = {.dirty = false, .clsReady = false};
+
+    /*
+     * A plain copy of the whole machine, which brings back its decoded instructions, its
+     * dirty pages and rows and its profile along with the rest, so nothing ever sees the
+     * frames ahead. Only the pages they write to are tracked meanwhile.
+     */
+    memcpy(snapshot, chip8, sizeof(Chip8));
+    chip8->trace = NULL;
+    chip8->dirtyPages = 0;
+
+    memcpy(presentation.drawn, chip8->gfx, sizeof(presentation.drawn));
+
+    for (unsigned int i = 0; i < session->runAhead; i++)
+    {
+        // Only the complete frame before a CLS of the last frame is worth showing
+        presentation.clsReady = false;
+
+        if (runFrame(session, PRESENT_TIMESTEP, &presentation) == CHIP8_STOP_ERROR)
+            break;
+    }
+
+    memcpy(frame, presentation.clsReady ? presentation.cls : chip8->gfx, sizeof(chip8->gfx));
+
+    // Translations made from memory the frames ahead changed don't hold for the restored one
+    bool rewritten = false;
+
+    for (uint64_t pages = chip8->dirtyPages; pages != 0 && !rewritten; pages &= pages - 1)
+    {
+        unsigned int address = __builtin_ctzll(pages) * CHIP8_PAGE_SIZE;
+
+        rewritten = memcmp(chip8->memory + address, snapshot->memory + address, CHIP8_PAGE_SIZE) != 0;
     }
+
+    memcpy(chip8, snapshot, sizeof(Chip8));
+
+    if (rewritten && session->jit != NULL)
+        jit_flush(session->jit);
+
+    if (rewritten && session->aot != NULL)
+        aot_refresh(session->aot);
+}
+
+Chip8StopReason runSlice(Session *session, double deltaTime, unsigned int maxCycles)
+{
+    if (session->aot != NULL)
+        return aot_runFor(session->aot, deltaTime, maxCycles);
+
+    if (session->jit != NULL)
+        return jit_runFor(session->jit, deltaTime, maxCycles);
+
+    return chip8_runFor(&session->chip8, deltaTime, maxCycles);
 }
 
 bool parseRGB(const char *str, unsigned char channel[3])
@@ -210,3 +878,40 @@ bool parseRGB(const char *str, unsigned char channel[3])
 
     return true;
 }
+
+#ifdef CHIP8_PROFILE
+// Write the profile of the session to <prefix>.json and <prefix>.folded
+void writeProfile(const Chip8Profile *profile, const char *name, const char *prefix)
+{
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s.json", prefix);
+    FILE *fp = fopen(path, "w");
+
+    if (fp != NULL)
+    {
+        chip8_profileJson(profile, name, fp);
+        fprintf(fp, "\n");
+        fclose(fp);
+        printf("\nProfile written to '%s'", path);
+    }
+    else
+    {
+        perror(path);
+    }
+
+    snprintf(path, sizeof(path), "%s.folded", prefix);
+    fp = fopen(path, "w");
+
+    if (fp != NULL)
+    {
+        chip8_profileFolded(profile, name, fp);
+        fclose(fp);
+        printf("\nProfile written to '%s'", path);
+    }
+    else
+    {
+        perror(path);
+    }
+}
+#endif
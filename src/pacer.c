@@ -0,0 +1,80 @@
+#include "../include/pacer.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+
+#define NANOSECONDS 1000000000LL
+
+// Frames behind schedule after which the pacer gives up catching up
+#define PACER_MAX_LAG 3
+
+int64_t pacer_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * NANOSECONDS + ts.tv_nsec;
+}
+
+void pacer_init(Pacer *pacer, double frequency)
+{
+    pacer->period = NANOSECONDS / frequency;
+    pacer->latest = pacer_now();
+    pacer->deadline = pacer->latest + pacer->period;
+    pacer->frames = 0;
+    pacer->skipped = 0;
+    pacer->jitterMax = 0;
+    pacer->jitterSum = 0;
+}
+
+double pacer_wait(Pacer *pacer)
+{
+    struct timespec deadline = {
+        .tv_sec = pacer->deadline / NANOSECONDS,
+        .tv_nsec = pacer->deadline % NANOSECONDS,
+    };
+
+    // Restart when a signal interrupts the sleep, the deadline being absolute
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+        ;
+
+    int64_t now = pacer_now();
+    int64_t jitter = now - pacer->deadline;
+
+    pacer->frames++;
+    pacer->jitterSum += jitter;
+
+    if (jitter > pacer->jitterMax)
+        pacer->jitterMax = jitter;
+
+    // Keep the schedule, unless it's too far behind to ever catch up
+    pacer->deadline += pacer->period;
+
+    if (now - pacer->deadline > PACER_MAX_LAG * pacer->period)
+    {
+        pacer->skipped += (now - pacer->deadline) / pacer->period;
+        pacer->deadline = now + pacer->period;
+    }
+
+    return pacer_elapsed(pacer);
+}
+
+double pacer_elapsed(Pacer *pacer)
+{
+    int64_t now = pacer_now();
+    double elapsed = (double)(now - pacer->latest) / NANOSECONDS;
+
+    pacer->latest = now;
+
+    return elapsed;
+}
+
+void pacer_report(const Pacer *pacer)
+{
+    if (pacer->frames == 0)
+        return;
+
+    printf("\nPacer: %lu frames, jitter %.1fus mean, %.1fus max, %lu frames skipped",
+           pacer->frames, pacer->jitterSum / pacer->frames / 1000, pacer->jitterMax / 1000.0, pacer->skipped);
+}
@@ -4,11 +4,15 @@
 
 SDL_Window *window = NULL;
 SDL_Renderer *renderer = NULL;
+SDL_Texture *texture = NULL; // The display, one texel per pixel, upscaled by SDL_RenderCopy
 int gfx_w;
 int gfx_h;
 unsigned char bg[3];
 unsigned char fg[3];
 
+// The 8 texels of each byte of a display row, from its most significant bit
+Uint32 expansion[256][8];
+
 bool gfx_init(int w, int h, unsigned char bg_colour[3], unsigned char fg_colour[3])
 {
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
@@ -32,31 +36,54 @@ bool gfx_init(int w, int h, unsigned char bg_colour[3], unsigned char fg_colour[
 
     SDL_RenderSetScale(renderer, (float)DM.w / gfx_w, (float)DM.h / gfx_h);
 
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, gfx_w, gfx_h);
+
+    if (texture == NULL)
+    {
+        SDL_Log("Failed to create the display texture. %s\n", SDL_GetError());
+        return false;
+    }
+
+    Uint32 bgTexel = 0xFF000000 | bg[0] << 16 | bg[1] << 8 | bg[2];
+    Uint32 fgTexel = 0xFF000000 | fg[0] << 16 | fg[1] << 8 | fg[2];
+
+    for (int byte = 0; byte < 256; byte++)
+    {
+        for (int bit = 0; bit < 8; bit++)
+            expansion[byte][bit] = (byte & (0x80 >> bit)) ? fgTexel : bgTexel;
+    }
+
     return true;
 }
 
-void gfx_draw(bool gfx[])
+void gfx_draw(const uint64_t gfx[])
 {
-    SDL_SetRenderDrawColor(renderer, bg[0], bg[1], bg[2], 255);
-    SDL_RenderClear(renderer);
+    void *pixels;
+    int pitch;
 
-    SDL_SetRenderDrawColor(renderer, fg[0], fg[1], fg[2], 255);
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch) != 0)
+        return;
 
-    for (int i = 0; i < gfx_w; i++)
+    // Every byte of a row turns into 8 texels at once, through the expansion table
+    for (int j = 0; j < gfx_h; j++)
     {
-        for (int j = 0; j < gfx_h; j++)
-        {
-            if (gfx[i + gfx_w * j])
-            {
-                SDL_RenderDrawPoint(renderer, i, j);
-            }
-        }
+        Uint32 *row = (Uint32 *)((Uint8 *)pixels + j * pitch);
+
+        for (int i = 0; i < gfx_w / 8; i++)
+            memcpy(row + i * 8, expansion[(gfx[j] >> (gfx_w - 8 - i * 8)) & 0xFF], sizeof(expansion[0]));
     }
 
+    SDL_UnlockTexture(texture);
+
+    // The texture covers the whole target, so there's nothing to clear
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
     SDL_RenderPresent(renderer);
 }
 
 void gfx_destroy()
 {
+    if (texture != NULL)
+        SDL_DestroyTexture(texture);
+
     SDL_Quit();
 }
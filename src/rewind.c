@@ -0,0 +1,336 @@
+#include "../include/rewind.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMORY_SIZE sizeof(((Chip8 *)0)->memory)
+
+// Bytes of deltas set aside per snapshot. Programs rewriting more than that on average get a shorter history
+#define AVERAGE_DELTA_SIZE 256
+
+// Everything rewinding restores besides the memory and the display
+typedef struct
+{
+    unsigned long cycles;
+    unsigned long long clock;
+    unsigned long timerCycles;
+    uint64_t rng;
+    long budget;
+    double budgetFraction;
+    double tTimerRegistersFrequency;
+
+    unsigned short stack[16];
+    unsigned short I;
+    unsigned short PC;
+
+    unsigned char V[18];
+    unsigned char SP;
+    unsigned char dt;
+    unsigned char st;
+    bool drawFlag;
+} Registers;
+
+// Delta from a snapshot back to the one before it
+typedef struct
+{
+    /*
+     * Pages and rows that differ between both. The registers of the snapshot before, then
+     * the former content of each page and row, lowest first, are stored at offset.
+     */
+    uint64_t pages;
+    uint32_t rows;
+
+    size_t offset;
+    size_t size;
+} Delta;
+
+struct Chip8Rewind
+{
+    Chip8 *chip8;
+
+    // Latest snapshot, kept whole
+    bool latest; // Whether there's one at all
+    Registers registers;
+    unsigned char memory[MEMORY_SIZE];
+    uint64_t gfx[CHIP8_GFX_H];
+
+    // Ring of the deltas back from the latest snapshot, holding up to length - 1 of them
+    Delta *deltas;
+    unsigned int length;
+    unsigned int first; // Oldest one
+    unsigned int count;
+
+    // Ring of the content of the deltas, in the same order
+    unsigned char *data;
+    size_t dataSize;
+};
+
+static void rewind_saveRegisters(const Chip8 *chip8, Registers *registers)
+{
+    registers->cycles = chip8->cycles;
+    registers->clock = chip8->clock;
+    registers->timerCycles = chip8->timerCycles;
+    registers->rng = chip8->rng;
+    registers->budget = chip8->budget;
+    registers->budgetFraction = chip8->budgetFraction;
+    registers->tTimerRegistersFrequency = chip8->tTimerRegistersFrequency;
+
+    memcpy(registers->stack, chip8->stack, sizeof(registers->stack));
+    registers->I = chip8->I;
+    registers->PC = chip8->PC;
+
+    memcpy(registers->V, chip8->V, sizeof(registers->V));
+    registers->SP = chip8->SP;
+    registers->dt = chip8->dt;
+    registers->st = chip8->st;
+    registers->drawFlag = chip8->drawFlag;
+}
+
+static void rewind_loadRegisters(Chip8 *chip8, const Registers *registers)
+{
+    chip8->cycles = registers->cycles;
+    chip8->clock = registers->clock;
+    chip8->timerCycles = registers->timerCycles;
+    chip8->rng = registers->rng;
+    chip8->budget = registers->budget;
+    chip8->budgetFraction = registers->budgetFraction;
+    chip8->tTimerRegistersFrequency = registers->tTimerRegistersFrequency;
+
+    memcpy(chip8->stack, registers->stack, sizeof(chip8->stack));
+    chip8->I = registers->I;
+    chip8->PC = registers->PC;
+
+    memcpy(chip8->V, registers->V, sizeof(chip8->V));
+    chip8->SP = registers->SP;
+    chip8->dt = registers->dt;
+    chip8->st = registers->st;
+    chip8->drawFlag = registers->drawFlag;
+}
+
+Chip8Rewind *rewind_create(Chip8 *chip8, unsigned int length)
+{
+    Chip8Rewind *rewind = calloc(1, sizeof(Chip8Rewind));
+
+    if (rewind == NULL)
+        return NULL;
+
+    rewind->chip8 = chip8;
+    rewind->length = length > 0 ? length : 1;
+
+    // Always enough for a delta of the whole machine, on top of the average ones
+    rewind->dataSize = (size_t)rewind->length * AVERAGE_DELTA_SIZE + sizeof(Registers) + MEMORY_SIZE + sizeof(chip8->gfx);
+    rewind->deltas = malloc(rewind->length * sizeof(Delta));
+    rewind->data = malloc(rewind->dataSize);
+
+    if (rewind->deltas == NULL || rewind->data == NULL)
+    {
+        rewind_destroy(rewind);
+        return NULL;
+    }
+
+    return rewind;
+}
+
+// Find room for a delta of the given size after the latest one, dropping the oldest ones in the way
+static size_t rewind_reserve(Chip8Rewind *rewind, size_t size)
+{
+    while (rewind->count > 0)
+    {
+        const Delta *oldest = &rewind->deltas[rewind->first];
+        const Delta *newest = &rewind->deltas[(rewind->first + rewind->count - 1) % rewind->length];
+        size_t end = newest->offset + newest->size;
+
+        if (rewind->count < rewind->length - 1)
+        {
+            // Deltas never have a size of 0, so the newest one only starts before the oldest one after wrapping around
+            if (newest->offset >= oldest->offset)
+            {
+                if (end + size <= rewind->dataSize)
+                    return end;
+
+                if (size <= oldest->offset)
+                    return 0;
+            }
+            else if (end + size <= oldest->offset)
+            {
+                return end;
+            }
+        }
+
+        rewind->first = (rewind->first + 1) % rewind->length;
+        rewind->count--;
+    }
+
+    return 0;
+}
+
+void rewind_push(Chip8Rewind *rewind)
+{
+    Chip8 *c = rewind->chip8;
+    Registers registers;
+
+    rewind_saveRegisters(c, &registers);
+
+    if (!rewind->latest)
+    {
+        memcpy(rewind->memory, c->memory, sizeof(rewind->memory));
+        memcpy(rewind->gfx, c->gfx, sizeof(rewind->gfx));
+        rewind->registers = registers;
+        rewind->latest = true;
+
+        c->dirtyPages = 0;
+        c->dirtyRows = 0;
+        return;
+    }
+
+    // Pages and rows written with what they already held are left out
+    uint64_t pages = 0;
+    uint32_t rows = 0;
+    size_t size = sizeof(Registers);
+
+    for (uint64_t dirty = c->dirtyPages; dirty != 0; dirty &= dirty - 1)
+    {
+        unsigned int page = __builtin_ctzll(dirty);
+
+        if (memcmp(c->memory + page * CHIP8_PAGE_SIZE, rewind->memory + page * CHIP8_PAGE_SIZE, CHIP8_PAGE_SIZE) != 0)
+        {
+            pages |= (uint64_t)1 << page;
+            size += CHIP8_PAGE_SIZE;
+        }
+    }
+
+    for (uint32_t dirty = c->dirtyRows; dirty != 0; dirty &= dirty - 1)
+    {
+        unsigned int row = __builtin_ctz(dirty);
+
+        if (c->gfx[row] != rewind->gfx[row])
+        {
+            rows |= (uint32_t)1 << row;
+            size += sizeof(uint64_t);
+        }
+    }
+
+    // Keep what the latest snapshot had there as the delta back to it, unless there's no room for any delta
+    if (rewind->length > 1)
+    {
+        size_t offset = rewind_reserve(rewind, size);
+        Delta *delta = &rewind->deltas[(rewind->first + rewind->count) % rewind->length];
+        unsigned char *data = rewind->data + offset;
+
+        delta->pages = pages;
+        delta->rows = rows;
+        delta->offset = offset;
+        delta->size = size;
+        rewind->count++;
+
+        memcpy(data, &rewind->registers, sizeof(Registers));
+        data += sizeof(Registers);
+
+        for (uint64_t bits = pages; bits != 0; bits &= bits - 1)
+        {
+            memcpy(data, rewind->memory + __builtin_ctzll(bits) * CHIP8_PAGE_SIZE, CHIP8_PAGE_SIZE);
+            data += CHIP8_PAGE_SIZE;
+        }
+
+        for (uint32_t bits = rows; bits != 0; bits &= bits - 1)
+        {
+            memcpy(data, &rewind->gfx[__builtin_ctz(bits)], sizeof(uint64_t));
+            data += sizeof(uint64_t);
+        }
+    }
+
+    // Then bring the latest snapshot up to date
+    for (uint64_t bits = pages; bits != 0; bits &= bits - 1)
+    {
+        unsigned int page = __builtin_ctzll(bits);
+
+        memcpy(rewind->memory + page * CHIP8_PAGE_SIZE, c->memory + page * CHIP8_PAGE_SIZE, CHIP8_PAGE_SIZE);
+    }
+
+    for (uint32_t bits = rows; bits != 0; bits &= bits - 1)
+    {
+        unsigned int row = __builtin_ctz(bits);
+
+        rewind->gfx[row] = c->gfx[row];
+    }
+
+    rewind->registers = registers;
+
+    c->dirtyPages = 0;
+    c->dirtyRows = 0;
+}
+
+bool rewind_pop(Chip8Rewind *rewind)
+{
+    Chip8 *c = rewind->chip8;
+
+    if (!rewind->latest)
+        return false;
+
+    // Undo whatever was written since the latest snapshot
+    for (uint64_t dirty = c->dirtyPages; dirty != 0; dirty &= dirty - 1)
+    {
+        unsigned short address = __builtin_ctzll(dirty) * CHIP8_PAGE_SIZE;
+
+        if (memcmp(c->memory + address, rewind->memory + address, CHIP8_PAGE_SIZE) != 0)
+        {
+            memcpy(c->memory + address, rewind->memory + address, CHIP8_PAGE_SIZE);
+            chip8_invalidateCode(c, address, CHIP8_PAGE_SIZE);
+        }
+    }
+
+    for (uint32_t dirty = c->dirtyRows; dirty != 0; dirty &= dirty - 1)
+    {
+        unsigned int row = __builtin_ctz(dirty);
+
+        c->gfx[row] = rewind->gfx[row];
+    }
+
+    rewind_loadRegisters(c, &rewind->registers);
+
+    c->dirtyPages = 0;
+    c->dirtyRows = 0;
+
+    if (rewind->count == 0)
+    {
+        rewind->latest = false;
+        return true;
+    }
+
+    // The snapshot before becomes the latest one, which the Chip8 now differs from wherever the delta applies
+    const Delta *delta = &rewind->deltas[(rewind->first + rewind->count - 1) % rewind->length];
+    const unsigned char *data = rewind->data + delta->offset;
+
+    memcpy(&rewind->registers, data, sizeof(Registers));
+    data += sizeof(Registers);
+
+    for (uint64_t bits = delta->pages; bits != 0; bits &= bits - 1)
+    {
+        memcpy(rewind->memory + __builtin_ctzll(bits) * CHIP8_PAGE_SIZE, data, CHIP8_PAGE_SIZE);
+        data += CHIP8_PAGE_SIZE;
+    }
+
+    for (uint32_t bits = delta->rows; bits != 0; bits &= bits - 1)
+    {
+        memcpy(&rewind->gfx[__builtin_ctz(bits)], data, sizeof(uint64_t));
+        data += sizeof(uint64_t);
+    }
+
+    c->dirtyPages = delta->pages;
+    c->dirtyRows = delta->rows;
+    rewind->count--;
+
+    return true;
+}
+
+unsigned int rewind_count(const Chip8Rewind *rewind)
+{
+    return rewind->count + rewind->latest;
+}
+
+void rewind_destroy(Chip8Rewind *rewind)
+{
+    free(rewind->deltas);
+    free(rewind->data);
+    free(rewind);
+}
@@ -0,0 +1,203 @@
+#include "../include/trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// How long the writer sleeps between two flushes, in nanoseconds
+#define FLUSH_PERIOD 5000000
+
+static void trace_writeGap(FILE *fp, unsigned long lost)
+{
+    uint64_t record = (uint64_t)CHIP8_TRACE_GAP << 60 | lost;
+
+    fwrite(&record, sizeof(record), 1, fp);
+}
+
+// Instructions a record stands for
+static unsigned long trace_instructions(uint64_t record)
+{
+    return CHIP8_TRACE_KIND(record) == CHIP8_TRACE_IDLE ? record >> 12 & ((1ULL << 48) - 1) : 1;
+}
+
+// Write out every record made since the previous flush, the last one once the Chip8 stopped. Writer thread only
+static void trace_flush(Chip8Trace *trace, bool last)
+{
+    unsigned long capacity = trace->mask + 1;
+    unsigned long head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    unsigned long tail = trace->tail;
+
+    // The record of index head is stored before being published, over that of head - capacity, until the Chip8 stops
+    unsigned long intact = last ? capacity : capacity - 1;
+
+    if (head - tail > intact)
+        tail = head - intact;
+
+    for (unsigned long i = tail; i < head; i++)
+    {
+        trace->buffer[i - tail] = atomic_load_explicit(&trace->records[i & trace->mask], memory_order_relaxed);
+        trace->bufferStarts[i - tail] = atomic_load_explicit(&trace->starts[i & trace->mask], memory_order_relaxed);
+    }
+
+    // Whatever got overwritten while copying is lost as well. The fence keeps the copy from
+    // moving past this load, pairing with the one of trace_record()
+    atomic_thread_fence(memory_order_acquire);
+    unsigned long written = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    unsigned long overwritten = !last && written - tail >= capacity ? written + 1 - capacity - tail : 0;
+
+    if (overwritten > head - tail)
+        overwritten = head - tail;
+
+    // Lost records are counted in instructions once the start of the next one that made it is known
+    if (tail + overwritten < head)
+    {
+        unsigned long kept = head - tail - overwritten;
+
+        if (trace->bufferStarts[overwritten] > trace->written)
+            trace_writeGap(trace->fp, trace->bufferStarts[overwritten] - trace->written);
+
+        fwrite(trace->buffer + overwritten, sizeof(uint64_t), kept, trace->fp);
+
+        trace->written = trace->bufferStarts[head - tail - 1] + trace_instructions(trace->buffer[head - tail - 1]);
+    }
+    else if (last && trace->instructions > trace->written)
+    {
+        // Nothing made it to the end, whose instruction count is final by now
+        trace_writeGap(trace->fp, trace->instructions - trace->written);
+        trace->written = trace->instructions;
+    }
+
+    trace->tail = head;
+}
+
+static void *trace_writer(void *arg)
+{
+    Chip8Trace *trace = (Chip8Trace *)arg;
+    struct timespec period = {.tv_sec = 0, .tv_nsec = FLUSH_PERIOD};
+
+    while (!atomic_load(&trace->stop))
+    {
+        trace_flush(trace, false);
+        nanosleep(&period, NULL);
+    }
+
+    // Then the records made up to the end
+    trace_flush(trace, true);
+
+    return NULL;
+}
+
+Chip8Trace *trace_create(unsigned long capacity, const char *path)
+{
+    Chip8Trace *trace = calloc(1, sizeof(Chip8Trace));
+    unsigned long size = 1;
+
+    if (trace == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate the trace.\n");
+        return NULL;
+    }
+
+    while (size < capacity)
+        size *= 2;
+
+    trace->mask = size - 1;
+    trace->records = malloc(size * sizeof(uint64_t));
+    trace->starts = malloc(size * sizeof(uint64_t));
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->stop, false);
+
+    if (trace->records == NULL || trace->starts == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocate the trace.\n");
+        free(trace->records);
+        free(trace->starts);
+        free(trace);
+        return NULL;
+    }
+
+    if (path == NULL)
+        return trace;
+
+    Chip8TraceHeader header = {.magic = CHIP8_TRACE_MAGIC, .version = CHIP8_TRACE_VERSION};
+
+    trace->buffer = malloc(size * sizeof(uint64_t));
+    trace->bufferStarts = malloc(size * sizeof(uint64_t));
+    trace->fp = fopen(path, "wb");
+
+    if (trace->buffer == NULL || trace->bufferStarts == NULL || trace->fp == NULL || fwrite(&header, sizeof(header), 1, trace->fp) != 1 ||
+        pthread_create(&trace->writer, NULL, trace_writer, trace) != 0)
+    {
+        fprintf(stderr, "Error: Failed to start tracing to '%s'.\n", path);
+
+        if (trace->fp != NULL)
+            fclose(trace->fp);
+
+        free(trace->buffer);
+        free(trace->bufferStarts);
+        free(trace->records);
+        free(trace->starts);
+        free(trace);
+        return NULL;
+    }
+
+    return trace;
+}
+
+bool trace_dump(const Chip8Trace *trace, const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    Chip8TraceHeader header = {.magic = CHIP8_TRACE_MAGIC, .version = CHIP8_TRACE_VERSION};
+    unsigned long head = atomic_load(&trace->head);
+    unsigned long first = head > trace->mask + 1 ? head - (trace->mask + 1) : 0;
+
+    if (fp == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    fwrite(&header, sizeof(header), 1, fp);
+
+    if (first > 0)
+        trace_writeGap(fp, atomic_load_explicit(&trace->starts[first & trace->mask], memory_order_relaxed));
+
+    for (unsigned long i = first; i < head; i++)
+    {
+        uint64_t record = atomic_load_explicit(&trace->records[i & trace->mask], memory_order_relaxed);
+
+        fwrite(&record, sizeof(record), 1, fp);
+    }
+
+    // Errors are sticky, so a single check covers every write
+    bool failed = ferror(fp) != 0;
+
+    if (fclose(fp) != 0 || failed)
+    {
+        fprintf(stderr, "Failed to write the trace '%s'.\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+void trace_destroy(Chip8Trace *trace)
+{
+    if (trace->fp != NULL)
+    {
+        atomic_store(&trace->stop, true);
+        pthread_join(trace->writer, NULL);
+
+        bool failed = ferror(trace->fp) != 0;
+
+        if (fclose(trace->fp) != 0 || failed)
+            fprintf(stderr, "Failed to write the whole trace.\n");
+
+        free(trace->buffer);
+        free(trace->bufferStarts);
+    }
+
+    free(trace->records);
+    free(trace->starts);
+    free(trace);
+}
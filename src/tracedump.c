@@ -0,0 +1,315 @@
+/*
+ * chip8-trace: decoder of the traces written by chip8 --trace and chip8-batch --trace.
+ * Prints one line per instruction: its index since tracing started, its address, its
+ * opCode, its disassembly and the registers it changed, so two traces can be diffed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "../include/trace.h"
+
+// Registers an instruction writes, besides PC
+typedef struct
+{
+    bool vx;
+    bool vf;
+    bool i;
+} Writes;
+
+bool parseArgs(int argc, char *argv[], unsigned long *from, unsigned long *count, const char **path);
+Writes disassemble(unsigned short opCode, char *text, size_t size);
+
+int main(int argc, char *argv[])
+{
+    unsigned long from = 0;
+    unsigned long count = ULONG_MAX;
+    const char *path = NULL;
+
+    if (!parseArgs(argc, argv, &from, &count, &path))
+    {
+        fprintf(stderr, "Usage: %s [--from <int>] [--count <int>] FILE\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *fp = fopen(path, "rb");
+    Chip8TraceHeader header;
+
+    if (fp == NULL)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != CHIP8_TRACE_MAGIC || header.version != CHIP8_TRACE_VERSION)
+    {
+        fprintf(stderr, "'%s' isn't a trace of this version of the emulator.\n", path);
+        fclose(fp);
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t records[4096];
+    size_t read;
+    unsigned long index = 0; // Of the next instruction, since tracing started
+    unsigned long end = from + count < from ? ULONG_MAX : from + count;
+
+    while (index < end && (read = fread(records, sizeof(uint64_t), sizeof(records) / sizeof(uint64_t), fp)) > 0)
+    {
+        for (size_t r = 0; r < read && index < end; r++)
+        {
+            uint64_t record = records[r];
+            unsigned long instructions = record & ((1ULL << 60) - 1);
+
+            if (CHIP8_TRACE_KIND(record) == CHIP8_TRACE_GAP)
+            {
+                if (index + instructions > from)
+                    printf("%10lu  ...  %lu instructions lost\n", index, instructions);
+
+                index += instructions;
+                continue;
+            }
+
+            unsigned short pc = record & 0xFFF;
+
+            if (CHIP8_TRACE_KIND(record) == CHIP8_TRACE_IDLE)
+            {
+                instructions >>= 12;
+
+                if (index + instructions > from)
+                    printf("%10lu  %03X  ...   %lu instructions of the idle loop fast-forwarded\n", index, pc, instructions);
+
+                index += instructions;
+                continue;
+            }
+
+            if (CHIP8_TRACE_KIND(record) != CHIP8_TRACE_INSTRUCTION)
+            {
+                fprintf(stderr, "'%s' holds an unknown record at instruction %lu.\n", path, index);
+                fclose(fp);
+                exit(EXIT_FAILURE);
+            }
+
+            if (index++ < from)
+                continue;
+
+            unsigned short opCode = record >> 12 & 0xFFFF;
+            unsigned short I = record >> 28 & 0xFFFF;
+            unsigned char vx = record >> 44 & 0xFF;
+            unsigned char vf = record >> 52 & 0xFF;
+            char text[32];
+            Writes writes = disassemble(opCode, text, sizeof(text));
+
+            // Padded only when followed by the registers written
+            printf("%10lu  %03X  %04X  %-*s", index - 1, pc, opCode, writes.vx || writes.vf || writes.i ? 16 : 0, text);
+
+            if (writes.vx)
+                printf(" V%X=%02X", opCode >> 8 & 0xF, vx);
+
+            if (writes.vf && (opCode >> 8 & 0xF) != 0xF)
+                printf(" VF=%02X", vf);
+
+            if (writes.i)
+                printf(" I=%03X", I);
+
+            printf("\n");
+        }
+    }
+
+    fclose(fp);
+
+    return EXIT_SUCCESS;
+}
+
+bool parseArgs(int argc, char *argv[], unsigned long *from, unsigned long *count, const char **path)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        char *endptr;
+
+        // [--from <int>]
+        if (strcmp(argv[i], "--from") == 0)
+        {
+            if (!hasValue || (*from = strtoul(argv[i + 1], &endptr, 0), *endptr != '\0' || endptr == argv[i + 1]))
+            {
+                fprintf(stderr, "Error: --from requires the index of the first instruction to print.\n");
+                return false;
+            }
+            i++;
+            continue;
+        }
+
+        // [--count <int>]
+        if (strcmp(argv[i], "--count") == 0)
+        {
+            if (!hasValue || (*count = strtoul(argv[i + 1], &endptr, 0), *endptr != '\0' || endptr == argv[i + 1]))
+            {
+                fprintf(stderr, "Error: --count requires the amount of instructions to print.\n");
+                return false;
+            }
+            i++;
+            continue;
+        }
+
+        if (*path != NULL)
+            return false;
+
+        *path = argv[i];
+    }
+
+    return *path != NULL;
+}
+
+// Write the mnemonic of the opCode to text and return what it changes
+Writes disassemble(unsigned short opCode, char *text, size_t size)
+{
+    unsigned char x = opCode >> 8 & 0xF;
+    unsigned char y = opCode >> 4 & 0xF;
+    unsigned char kk = opCode & 0xFF;
+    unsigned short nnn = opCode & 0xFFF;
+    Writes none = {false, false, false};
+    Writes vx = {true, false, false};
+    Writes vxf = {true, true, false};
+    Writes i = {false, false, true};
+
+    switch (opCode >> 12)
+    {
+    case 0x0:
+        if (opCode == 0x00E0)
+        {
+            snprintf(text, size, "CLS");
+            return none;
+        }
+
+        if (opCode == 0x00EE)
+        {
+            snprintf(text, size, "RET");
+            return none;
+        }
+        break;
+
+    case 0x1:
+        snprintf(text, size, "JP %03X", nnn);
+        return none;
+
+    case 0x2:
+        snprintf(text, size, "CALL %03X", nnn);
+        return none;
+
+    case 0x3:
+        snprintf(text, size, "SE V%X, %X", x, kk);
+        return none;
+
+    case 0x4:
+        snprintf(text, size, "SNE V%X, %X", x, kk);
+        return none;
+
+    case 0x5:
+        if ((opCode & 0xF) == 0)
+        {
+            snprintf(text, size, "SE V%X, V%X", x, y);
+            return none;
+        }
+        break;
+
+    case 0x6:
+        snprintf(text, size, "LD V%X, %X", x, kk);
+        return vx;
+
+    case 0x7:
+        snprintf(text, size, "ADD V%X, %X", x, kk);
+        return vx;
+
+    case 0x8:
+    {
+        static const char *const MNEMONICS[16] = {"LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN", [0xE] = "SHL"};
+        const char *mnemonic = MNEMONICS[opCode & 0xF];
+
+        if (mnemonic == NULL)
+            break;
+
+        snprintf(text, size, "%s V%X, V%X", mnemonic, x, y);
+
+        return (opCode & 0xF) >= 0x4 ? vxf : vx;
+    }
+
+    case 0x9:
+        if ((opCode & 0xF) == 0)
+        {
+            snprintf(text, size, "SNE V%X, V%X", x, y);
+            return none;
+        }
+        break;
+
+    case 0xA:
+        snprintf(text, size, "LD I, %03X", nnn);
+        return i;
+
+    case 0xB:
+        snprintf(text, size, "JP V0, %03X", nnn);
+        return none;
+
+    case 0xC:
+        snprintf(text, size, "RND V%X, %X", x, kk);
+        return vx;
+
+    case 0xD:
+        snprintf(text, size, "DRW V%X, V%X, %X", x, y, opCode & 0xF);
+        return (Writes){false, true, false};
+
+    case 0xE:
+        if (kk == 0x9E)
+        {
+            snprintf(text, size, "SKP V%X", x);
+            return none;
+        }
+
+        if (kk == 0xA1)
+        {
+            snprintf(text, size, "SKNP V%X", x);
+            return none;
+        }
+        break;
+
+    case 0xF:
+        switch (kk)
+        {
+        case 0x07:
+            snprintf(text, size, "LD V%X, DT", x);
+            return vx;
+        case 0x0A:
+            snprintf(text, size, "LD V%X, K", x);
+            return vx;
+        case 0x15:
+            snprintf(text, size, "LD DT, V%X", x);
+            return none;
+        case 0x18:
+            snprintf(text, size, "LD ST, V%X", x);
+            return none;
+        case 0x1E:
+            snprintf(text, size, "ADD I, V%X", x);
+            return i;
+        case 0x29:
+            snprintf(text, size, "LD F, V%X", x);
+            return i;
+        case 0x33:
+            snprintf(text, size, "LD B, V%X", x);
+            return none;
+        case 0x55:
+            snprintf(text, size, "LD [I], V%X", x);
+            return none;
+        case 0x65:
+            snprintf(text, size, "LD V%X, [I]", x);
+            return vx;
+        }
+        break;
+    }
+
+    snprintf(text, size, "DATA %04X", opCode);
+
+    return none;
+}
@@ -0,0 +1,45 @@
+#include "../include/triplebuffer.h"
+
+#include <string.h>
+
+// Set on the spare index when it holds a frame the consumer hasn't taken yet
+#define TRIPLEBUFFER_FRESH 4u
+
+void triplebuffer_init(TripleBuffer *buffer)
+{
+    memset(buffer->frames, 0, sizeof(buffer->frames));
+
+    buffer->back = 0;
+    buffer->front = 1;
+    atomic_init(&buffer->spare, 2);
+}
+
+uint64_t *triplebuffer_back(TripleBuffer *buffer)
+{
+    return buffer->frames[buffer->back];
+}
+
+void triplebuffer_publish(TripleBuffer *buffer)
+{
+    // The release makes the frame visible to the consumer along with its index
+    unsigned int previous = atomic_exchange_explicit(&buffer->spare, buffer->back | TRIPLEBUFFER_FRESH, memory_order_acq_rel);
+
+    buffer->back = previous & ~TRIPLEBUFFER_FRESH;
+}
+
+bool triplebuffer_acquire(TripleBuffer *buffer)
+{
+    if ((atomic_load_explicit(&buffer->spare, memory_order_relaxed) & TRIPLEBUFFER_FRESH) == 0)
+        return false;
+
+    unsigned int previous = atomic_exchange_explicit(&buffer->spare, buffer->front, memory_order_acq_rel);
+
+    buffer->front = previous & ~TRIPLEBUFFER_FRESH;
+
+    return true;
+}
+
+const uint64_t *triplebuffer_front(const TripleBuffer *buffer)
+{
+    return buffer->frames[buffer->front];
+}